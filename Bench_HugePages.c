@@ -0,0 +1,106 @@
+/* Measures dTLB misses of a pointer chasing workload over many small
+ * objects, once with plain 4 KB VM pages and once per huge page mode.
+ * Each mode runs in a forked child so that regions are not shared.
+ *
+ * gcc -O2 -pthread Bench_HugePages.c MemoryManager.c glthread.c -o bench_huge
+ * ./bench_huge [no_of_objects] [no_of_passes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include "Bench_Perf.h"
+#include "UserAPI_MemoryManager.h"
+
+typedef struct node_{
+
+    struct node_ *next;
+    uint64_t payload[6];
+} node_t;
+
+static void
+run_mode(mm_huge_page_mode_t mode, const char *mode_name,
+        int n_objects, int n_passes){
+
+    int i;
+    uint64_t sum = 0;
+    double start, elapsed;
+    bench_perf_t perf;
+    node_t **nodes = malloc(sizeof(node_t *) * n_objects);
+
+    mm_init();
+    mm_set_huge_page_mode(mode);
+    MM_REG_STRUCT(node_t);
+
+    for(i = 0; i < n_objects; i++)
+        nodes[i] = XCALLOC(1, node_t);
+
+    /*Link the objects in a random order to defeat the prefetcher*/
+    srand(1);
+    for(i = n_objects - 1; i > 0; i--){
+        int j = rand() % (i + 1);
+        node_t *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+    for(i = 0; i < n_objects; i++)
+        nodes[i]->next = nodes[(i + 1) % n_objects];
+
+    bench_perf_open(&perf);
+    bench_perf_start(&perf);
+
+    start = bench_now_ns();
+    for(i = 0; i < n_passes; i++){
+        node_t *node = nodes[0];
+        do {
+            sum += node->payload[0];
+            node = node->next;
+        } while(node != nodes[0]);
+    }
+    elapsed = (bench_now_ns() - start) / 1e6;
+
+    bench_perf_stop(&perf);
+    bench_perf_close(&perf);
+
+    if(perf.value[BENCH_PERF_DTLB_MISSES] >= 0)
+        printf("%-12s %10.1f ms %14lld dTLB misses\n", mode_name, elapsed,
+                (long long)perf.value[BENCH_PERF_DTLB_MISSES]);
+    else
+        printf("%-12s %10.1f ms %14s dTLB misses\n", mode_name,
+                elapsed, "n/a");
+
+    for(i = 0; i < n_objects; i++)
+        XFREE(nodes[i]);
+    free(nodes);
+    if(sum == 1) printf("\n");
+}
+
+int
+main(int argc, char **argv){
+
+    int i;
+    int n_objects = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    int n_passes = argc > 2 ? atoi(argv[2]) : 10;
+
+    struct { mm_huge_page_mode_t mode; const char *name; } modes[] = {
+        {MM_HUGE_PAGE_NONE,        "4k-pages"},
+        {MM_HUGE_PAGE_TRANSPARENT, "thp"},
+        {MM_HUGE_PAGE_EXPLICIT,    "hugetlb"},
+    };
+
+    printf("%d objects of %zu bytes, %d passes\n",
+            n_objects, sizeof(node_t), n_passes);
+    fflush(stdout);
+
+    for(i = 0; i < 3; i++){
+        pid_t pid = fork();
+        if(pid == 0){
+            run_mode(modes[i].mode, modes[i].name, n_objects, n_passes);
+            fflush(stdout);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
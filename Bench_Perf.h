@@ -0,0 +1,121 @@
+/* Timing, RSS and hardware counter helpers shared by the Bench_*.c
+ * drivers. Counters come from perf_event_open and read as -1 where
+ * the kernel or the sandbox does not allow them*/
+
+#ifndef __BENCH_PERF__
+#define __BENCH_PERF__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+typedef enum{
+
+    BENCH_PERF_CACHE_MISSES,
+    BENCH_PERF_DTLB_MISSES,
+    BENCH_PERF_COUNTERS
+} bench_perf_counter_t;
+
+typedef struct bench_perf_{
+
+    int fd[BENCH_PERF_COUNTERS];
+    int64_t value[BENCH_PERF_COUNTERS];
+} bench_perf_t;
+
+static inline int
+bench_perf_event_open(uint32_t type, uint64_t config){
+
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline void
+bench_perf_open(bench_perf_t *perf){
+
+    perf->fd[BENCH_PERF_CACHE_MISSES] = bench_perf_event_open(
+            PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    perf->fd[BENCH_PERF_DTLB_MISSES] = bench_perf_event_open(
+            PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static inline void
+bench_perf_start(bench_perf_t *perf){
+
+    int i = 0;
+
+    for( ; i < BENCH_PERF_COUNTERS; i++){
+        if(perf->fd[i] < 0)
+            continue;
+        ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static inline void
+bench_perf_stop(bench_perf_t *perf){
+
+    int i = 0;
+
+    for( ; i < BENCH_PERF_COUNTERS; i++){
+        perf->value[i] = -1;
+        if(perf->fd[i] < 0)
+            continue;
+        ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if(read(perf->fd[i], &perf->value[i], sizeof(perf->value[i])) !=
+                sizeof(perf->value[i])){
+            perf->value[i] = -1;
+        }
+    }
+}
+
+static inline void
+bench_perf_close(bench_perf_t *perf){
+
+    int i = 0;
+
+    for( ; i < BENCH_PERF_COUNTERS; i++){
+        if(perf->fd[i] >= 0)
+            close(perf->fd[i]);
+        perf->fd[i] = -1;
+    }
+}
+
+static inline double
+bench_now_ns(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*Resident set size of the calling process*/
+static inline long
+bench_rss_kb(){
+
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if(!fp)
+        return -1;
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = -1;
+    fclose(fp);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+#endif /* __BENCH_PERF__ */
@@ -0,0 +1,144 @@
+/* Tracks resident pages of a long lived churn workload under each
+ * block placement policy. A quarter of the live objects are long lived
+ * and replaced at random now and then, the others are short lived and
+ * recycled first in first out. Half way through, the short lived load
+ * drops to an eighth, which is when blocks spread over many pages keep
+ * them all mapped around the long lived survivors. Objects are 1 to
+ * BENCH_MAX_UNITS units. Each policy runs in a forked child with the
+ * page caches disabled, so that an emptied page is unmapped at once.
+ *
+ * gcc -O2 -pthread Bench_Placement.c MemoryManager.c glthread.c -o bench_placement
+ * ./bench_placement [live_objects] [ops]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "Bench_Perf.h"
+#include "UserAPI_MemoryManager.h"
+
+#define BENCH_MAX_UNITS     8
+#define BENCH_SAMPLES       10
+
+typedef struct bench_obj_{
+
+    char data[48];
+} bench_obj_t;
+
+static uint64_t
+bench_rand(uint64_t *rng){
+
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+static void
+run_policy(mm_placement_policy_t placement, const char *policy_name,
+        int n_live, long n_ops){
+
+    long op = 0;
+    long slot = 0;
+    int n_long = n_live / 4;
+    int n_short = n_live - n_long;
+    int short_load = n_short;
+    uint64_t rng = 88172645463325252ULL;
+    double start = 0;
+    mm_family_stats_t family_stats;
+    mm_stats_t stats;
+    mm_family_attr_t attr;
+    mm_family_handle_t handle;
+    void **long_slots = calloc(n_long, sizeof(void *));
+    void **short_slots = calloc(n_short, sizeof(void *));
+
+    mm_init();
+    mm_set_page_cache_limits(0, 0);
+    memset(&attr, 0, sizeof(attr));
+    attr.placement = placement;
+    handle = MM_REG_STRUCT_EX(bench_obj_t, &attr);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.families = &family_stats;
+    stats.families_capacity = 1;
+
+    start = bench_now_ns();
+    for(op = 0; op < n_ops; op++){
+
+        if(op == n_ops / 2)
+            short_load = n_short / 8;
+
+        if(bench_rand(&rng) % 16 == 0){
+            slot = (long)(bench_rand(&rng) % n_long);
+            if(long_slots[slot])
+                xfree(long_slots[slot]);
+            long_slots[slot] = xcalloc_h(handle,
+                    1 + (int)(bench_rand(&rng) % BENCH_MAX_UNITS));
+        }
+        else {
+            slot = op % n_short;
+            if(short_slots[slot]){
+                xfree(short_slots[slot]);
+                short_slots[slot] = NULL;
+            }
+            if(slot < short_load){
+                short_slots[slot] = xcalloc_h(handle,
+                        1 + (int)(bench_rand(&rng) % BENCH_MAX_UNITS));
+            }
+        }
+
+        if((op + 1) % (n_ops / BENCH_SAMPLES) == 0){
+            /*Blocks parked in the thread cache count as free*/
+            mm_tcache_flush();
+            mm_get_stats(&stats);
+            printf("%-14s %10ld %10lu %8lu %10ld %10.2f %8.1f\n", policy_name,
+                    op + 1, family_stats.bytes_in_use / 1024,
+                    family_stats.pages_mapped, bench_rss_kb(),
+                    (double)family_stats.pages_mapped * 4096 /
+                    (family_stats.bytes_in_use ? family_stats.bytes_in_use : 1),
+                    (bench_now_ns() - start) / (n_ops / BENCH_SAMPLES));
+            start = bench_now_ns();
+        }
+    }
+    free(long_slots);
+    free(short_slots);
+}
+
+int
+main(int argc, char **argv){
+
+    int i;
+    int n_live = argc > 1 ? atoi(argv[1]) : 100000;
+    long n_ops = argc > 2 ? atol(argv[2]) : 4000000;
+
+    struct { mm_placement_policy_t placement; const char *name; } policies[] = {
+        {MM_PLACEMENT_BEST_FIT,     "best-fit"},
+        {MM_PLACEMENT_FIRST_FIT,    "first-fit"},
+        {MM_PLACEMENT_FULLEST_PAGE, "fullest-page"},
+    };
+
+    if(n_live < 8)
+        n_live = 8;
+    if(n_ops < BENCH_SAMPLES)
+        n_ops = BENCH_SAMPLES;
+
+    printf("%d live objects of 1-%d x %zu bytes, %ld ops\n",
+            n_live, BENCH_MAX_UNITS, sizeof(bench_obj_t), n_ops);
+    printf("%-14s %10s %10s %8s %10s %10s %8s\n", "policy", "ops",
+            "live_kb", "pages", "rss_kb", "pages/live", "ns/op");
+    fflush(stdout);
+
+    for(i = 0; i < 3; i++){
+        pid_t pid = fork();
+        if(pid == 0){
+            run_policy(policies[i].placement, policies[i].name,
+                    n_live, n_ops);
+            fflush(stdout);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
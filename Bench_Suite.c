@@ -0,0 +1,529 @@
+/* Microbenchmarks of the memory manager against glibc malloc. Every
+ * workload runs once per allocator in a forked child, so that neither
+ * RSS nor cached pages carry over between runs, and the child reports
+ * back over a pipe. Object sizes and random streams are fixed, hence
+ * two runs on the same machine are comparable.
+ *
+ * gcc -O2 -pthread Bench_Suite.c MemoryManager.c glthread.c -o bench_suite
+ * ./bench_suite [-f csv|json] [-n live_objects] [-o ops] [-t threads]
+ *               [-w workload]
+ *
+ * Counters which are not available read as empty (csv) or null (json),
+ * pages_mapped is only known for the memory manager. The threaded
+ * workload splits the live objects and ops over its threads, the
+ * counters only cover the first of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "Bench_Perf.h"
+#include "UserAPI_MemoryManager.h"
+
+#define BENCH_FAMILIES      3
+#define BENCH_MAX_UNITS     8
+#define BENCH_MAX_THREADS   64
+
+typedef struct bench_small_  { char data[24];  } bench_small_t;
+typedef struct bench_medium_ { char data[72];  } bench_medium_t;
+typedef struct bench_large_  { char data[200]; } bench_large_t;
+
+static const uint32_t family_sizes[BENCH_FAMILIES] = {
+    sizeof(bench_small_t), sizeof(bench_medium_t), sizeof(bench_large_t)
+};
+
+typedef struct bench_allocator_{
+
+    const char *name;
+    void (*init)(void);
+    void *(*alloc)(int family, int units);
+    void (*free)(void *ptr);
+    long (*pages_mapped)(void);
+} bench_allocator_t;
+
+typedef struct bench_result_{
+
+    uint64_t ops;
+    double ns;
+    long rss_kb;
+    long pages_mapped;
+    int64_t counters[BENCH_PERF_COUNTERS];
+} bench_result_t;
+
+typedef struct bench_ctx_{
+
+    bench_allocator_t *allocator;
+    void **slots;
+    int n_live;
+    uint64_t n_ops;
+    int n_threads;
+    uint64_t rng;
+    bench_perf_t perf;
+    double start_ns;
+    bench_result_t result;
+} bench_ctx_t;
+
+/*Memory manager*/
+
+static mm_family_handle_t mm_handles[BENCH_FAMILIES];
+
+static void
+mm_bench_init(void){
+
+    mm_init();
+    mm_handles[0] = MM_REG_STRUCT(bench_small_t);
+    mm_handles[1] = MM_REG_STRUCT(bench_medium_t);
+    mm_handles[2] = MM_REG_STRUCT(bench_large_t);
+}
+
+static void *
+mm_bench_alloc(int family, int units){
+
+    return xcalloc_h(mm_handles[family], units);
+}
+
+static void
+mm_bench_free(void *ptr){
+
+    xfree(ptr);
+}
+
+static long
+mm_bench_pages_mapped(void){
+
+    mm_stats_t stats;
+
+    memset(&stats, 0, sizeof(stats));
+    mm_get_stats(&stats);
+    return (long)stats.pages_mapped;
+}
+
+/*glibc*/
+
+static void
+libc_bench_init(void){
+}
+
+static void *
+libc_bench_alloc(int family, int units){
+
+    return calloc(units, family_sizes[family]);
+}
+
+static void
+libc_bench_free(void *ptr){
+
+    free(ptr);
+}
+
+static long
+libc_bench_pages_mapped(void){
+
+    return -1;
+}
+
+static bench_allocator_t allocators[] = {
+    {"mm",    mm_bench_init,   mm_bench_alloc,   mm_bench_free,
+        mm_bench_pages_mapped},
+    {"glibc", libc_bench_init, libc_bench_alloc, libc_bench_free,
+        libc_bench_pages_mapped},
+};
+
+static inline uint64_t
+bench_rand(bench_ctx_t *ctx){
+
+    /*xorshift64*/
+    ctx->rng ^= ctx->rng << 13;
+    ctx->rng ^= ctx->rng >> 7;
+    ctx->rng ^= ctx->rng << 17;
+    return ctx->rng;
+}
+
+static void
+bench_begin(bench_ctx_t *ctx){
+
+    bench_perf_start(&ctx->perf);
+    ctx->start_ns = bench_now_ns();
+}
+
+/*Sampled at the end of the timed phase, while the live set is in place*/
+static void
+bench_end(bench_ctx_t *ctx, uint64_t ops){
+
+    ctx->result.ns = bench_now_ns() - ctx->start_ns;
+    bench_perf_stop(&ctx->perf);
+    ctx->result.ops = ops;
+    ctx->result.rss_kb = bench_rss_kb();
+    ctx->result.pages_mapped = ctx->allocator->pages_mapped();
+    memcpy(ctx->result.counters, ctx->perf.value,
+            sizeof(ctx->result.counters));
+}
+
+static void
+bench_fill(bench_ctx_t *ctx, int mixed){
+
+    int i;
+
+    for(i = 0; i < ctx->n_live; i++){
+        ctx->slots[i] = ctx->allocator->alloc(
+            mixed ? bench_rand(ctx) % BENCH_FAMILIES : 0, 1);
+    }
+}
+
+static void
+bench_drain(bench_ctx_t *ctx){
+
+    int i;
+
+    for(i = 0; i < ctx->n_live; i++){
+        if(ctx->slots[i])
+            ctx->allocator->free(ctx->slots[i]);
+        ctx->slots[i] = NULL;
+    }
+}
+
+/*Replaces a random live object per iteration*/
+static void
+bench_churn(bench_ctx_t *ctx, int mixed, int vary_units){
+
+    uint64_t i, iterations = ctx->n_ops / 2;
+
+    bench_begin(ctx);
+    for(i = 0; i < iterations; i++){
+        uint64_t r = bench_rand(ctx);
+        int slot = r % ctx->n_live;
+        int family = mixed ? (r >> 32) % BENCH_FAMILIES : 0;
+        int units = vary_units ? 1 + (r >> 40) % BENCH_MAX_UNITS : 1;
+        ctx->allocator->free(ctx->slots[slot]);
+        ctx->slots[slot] = ctx->allocator->alloc(family, units);
+    }
+    bench_end(ctx, iterations * 2);
+}
+
+/*Workloads*/
+
+static void
+wl_lifo(bench_ctx_t *ctx){
+
+    int i;
+    uint64_t round, rounds = ctx->n_ops / (2 * ctx->n_live) + 1;
+
+    bench_begin(ctx);
+    for(round = 0; round < rounds; round++){
+        for(i = 0; i < ctx->n_live; i++)
+            ctx->slots[i] = ctx->allocator->alloc(0, 1);
+        for(i = ctx->n_live - 1; i >= 0; i--)
+            ctx->allocator->free(ctx->slots[i]);
+    }
+    bench_end(ctx, rounds * ctx->n_live * 2);
+    memset(ctx->slots, 0, sizeof(void *) * ctx->n_live);
+}
+
+static void
+wl_fifo(bench_ctx_t *ctx){
+
+    uint64_t i, iterations = ctx->n_ops / 2;
+
+    bench_fill(ctx, 0);
+    bench_begin(ctx);
+    for(i = 0; i < iterations; i++){
+        int slot = i % ctx->n_live;
+        ctx->allocator->free(ctx->slots[slot]);
+        ctx->slots[slot] = ctx->allocator->alloc(0, 1);
+    }
+    bench_end(ctx, iterations * 2);
+}
+
+static void
+wl_random_free(bench_ctx_t *ctx){
+
+    int i;
+    uint64_t round, rounds = ctx->n_ops / (2 * ctx->n_live) + 1;
+
+    bench_begin(ctx);
+    for(round = 0; round < rounds; round++){
+        for(i = 0; i < ctx->n_live; i++)
+            ctx->slots[i] = ctx->allocator->alloc(0, 1);
+        for(i = ctx->n_live - 1; i > 0; i--){
+            int j = bench_rand(ctx) % (i + 1);
+            void *tmp = ctx->slots[i];
+            ctx->slots[i] = ctx->slots[j];
+            ctx->slots[j] = tmp;
+        }
+        for(i = 0; i < ctx->n_live; i++)
+            ctx->allocator->free(ctx->slots[i]);
+    }
+    bench_end(ctx, rounds * ctx->n_live * 2);
+    memset(ctx->slots, 0, sizeof(void *) * ctx->n_live);
+}
+
+static void
+wl_mixed_families(bench_ctx_t *ctx){
+
+    bench_fill(ctx, 1);
+    bench_churn(ctx, 1, 0);
+}
+
+static void
+wl_varying_units(bench_ctx_t *ctx){
+
+    bench_fill(ctx, 0);
+    bench_churn(ctx, 0, 1);
+}
+
+/*Every allocation lands on memory not used before*/
+static void
+wl_growth(bench_ctx_t *ctx){
+
+    bench_begin(ctx);
+    bench_fill(ctx, 0);
+    bench_end(ctx, ctx->n_live);
+}
+
+/*Same live set as growth, but recycling freed memory*/
+static void
+wl_steady_state(bench_ctx_t *ctx){
+
+    bench_fill(ctx, 0);
+    bench_churn(ctx, 0, 0);
+}
+
+/* Every thread churns a live set of its own, all in the same page
+ * family, so that only the page family is shared*/
+static void *
+wl_threaded_churn_thread(void *arg){
+
+    bench_ctx_t *ctx = arg;
+    uint64_t i, iterations = ctx->n_ops / 2;
+
+    for(i = 0; i < iterations; i++){
+        int slot = bench_rand(ctx) % ctx->n_live;
+        ctx->allocator->free(ctx->slots[slot]);
+        ctx->slots[slot] = ctx->allocator->alloc(0, 1);
+    }
+    return NULL;
+}
+
+static void
+wl_threaded_churn(bench_ctx_t *ctx){
+
+    int i;
+    uint64_t ops = 0;
+    pthread_t threads[BENCH_MAX_THREADS];
+    bench_ctx_t thread_ctx[BENCH_MAX_THREADS];
+
+    for(i = 0; i < ctx->n_threads; i++){
+        thread_ctx[i] = *ctx;
+        thread_ctx[i].slots = ctx->slots + i * (ctx->n_live / ctx->n_threads);
+        thread_ctx[i].n_live = ctx->n_live / ctx->n_threads;
+        thread_ctx[i].n_ops = ctx->n_ops / ctx->n_threads;
+        thread_ctx[i].rng = ctx->rng + i;
+        bench_fill(&thread_ctx[i], 0);
+        ops += thread_ctx[i].n_ops / 2 * 2;
+    }
+
+    bench_begin(ctx);
+    for(i = 1; i < ctx->n_threads; i++){
+        if(pthread_create(&threads[i], NULL, wl_threaded_churn_thread,
+                    &thread_ctx[i]))
+            _exit(1);
+    }
+    wl_threaded_churn_thread(&thread_ctx[0]);
+    for(i = 1; i < ctx->n_threads; i++)
+        pthread_join(threads[i], NULL);
+    bench_end(ctx, ops);
+}
+
+static struct {
+    const char *name;
+    void (*run)(bench_ctx_t *ctx);
+} workloads[] = {
+    {"lifo",            wl_lifo},
+    {"fifo",            wl_fifo},
+    {"random_free",     wl_random_free},
+    {"mixed_families",  wl_mixed_families},
+    {"varying_units",   wl_varying_units},
+    {"growth",          wl_growth},
+    {"steady_state",    wl_steady_state},
+    {"threaded_churn",  wl_threaded_churn},
+};
+
+#define BENCH_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+#define BENCH_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+static void
+bench_run_child(int workload, bench_allocator_t *allocator,
+        int n_live, uint64_t n_ops, int n_threads, int fd){
+
+    bench_ctx_t ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.allocator = allocator;
+    ctx.n_live = n_live;
+    ctx.n_ops = n_ops;
+    ctx.n_threads = n_threads;
+    ctx.rng = 0x9e3779b97f4a7c15ULL + workload;
+    ctx.slots = calloc(n_live, sizeof(void *));
+
+    allocator->init();
+    bench_perf_open(&ctx.perf);
+    workloads[workload].run(&ctx);
+    bench_perf_close(&ctx.perf);
+    bench_drain(&ctx);
+
+    if(write(fd, &ctx.result, sizeof(ctx.result)) != sizeof(ctx.result))
+        _exit(1);
+    _exit(0);
+}
+
+static int
+bench_run(int workload, bench_allocator_t *allocator,
+        int n_live, uint64_t n_ops, int n_threads, bench_result_t *result){
+
+    int fds[2];
+    ssize_t n;
+    pid_t pid;
+
+    if(pipe(fds) < 0)
+        return -1;
+
+    pid = fork();
+    if(pid < 0){
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if(pid == 0){
+        close(fds[0]);
+        bench_run_child(workload, allocator, n_live, n_ops, n_threads,
+                fds[1]);
+    }
+
+    close(fds[1]);
+    n = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return n == sizeof(*result) ? 0 : -1;
+}
+
+static void
+bench_print_value(int64_t value, int json){
+
+    if(value >= 0)
+        printf("%lld", (long long)value);
+    else if(json)
+        printf("null");
+}
+
+static void
+bench_print_result(const char *workload, const char *allocator,
+        bench_result_t *result, int json, int first){
+
+    if(json){
+        printf("%s\n  {\"workload\": \"%s\", \"allocator\": \"%s\", "
+                "\"ops\": %llu, \"ns_per_op\": %.2f, \"rss_kb\": ",
+                first ? "" : ",", workload, allocator,
+                (unsigned long long)result->ops,
+                result->ns / result->ops);
+        bench_print_value(result->rss_kb, 1);
+        printf(", \"pages_mapped\": ");
+        bench_print_value(result->pages_mapped, 1);
+        printf(", \"cache_misses\": ");
+        bench_print_value(result->counters[BENCH_PERF_CACHE_MISSES], 1);
+        printf(", \"dtlb_misses\": ");
+        bench_print_value(result->counters[BENCH_PERF_DTLB_MISSES], 1);
+        printf("}");
+        return;
+    }
+
+    printf("%s,%s,%llu,%.2f,", workload, allocator,
+            (unsigned long long)result->ops, result->ns / result->ops);
+    bench_print_value(result->rss_kb, 0);
+    printf(",");
+    bench_print_value(result->pages_mapped, 0);
+    printf(",");
+    bench_print_value(result->counters[BENCH_PERF_CACHE_MISSES], 0);
+    printf(",");
+    bench_print_value(result->counters[BENCH_PERF_DTLB_MISSES], 0);
+    printf("\n");
+}
+
+int
+main(int argc, char **argv){
+
+    int opt, json = 0, first = 1;
+    int n_live = 50000;
+    uint64_t n_ops = 2000000;
+    int n_threads = 4;
+    const char *only = NULL;
+    unsigned int i, j;
+    bench_result_t result;
+
+    while((opt = getopt(argc, argv, "f:n:o:t:w:")) != -1){
+        switch(opt){
+            case 'f':
+                json = strcmp(optarg, "json") == 0;
+                break;
+            case 'n':
+                n_live = atoi(optarg);
+                break;
+            case 'o':
+                n_ops = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                n_threads = atoi(optarg);
+                break;
+            case 'w':
+                only = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage : %s [-f csv|json] [-n live_objects] "
+                        "[-o ops] [-t threads] [-w workload]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(n_live <= 0 || n_ops == 0){
+        fprintf(stderr, "Error : live_objects and ops must be positive\n");
+        return 1;
+    }
+    if(n_threads <= 0 || n_threads > BENCH_MAX_THREADS ||
+            n_threads > n_live){
+        fprintf(stderr, "Error : threads must be 1 to %d, and at most "
+                "live_objects\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    if(json)
+        printf("[");
+    else
+        printf("workload,allocator,ops,ns_per_op,rss_kb,pages_mapped,"
+                "cache_misses,dtlb_misses\n");
+    fflush(stdout);
+
+    for(i = 0; i < BENCH_WORKLOADS; i++){
+        if(only && strcmp(only, workloads[i].name))
+            continue;
+        for(j = 0; j < BENCH_ALLOCATORS; j++){
+            if(bench_run(i, &allocators[j], n_live, n_ops, n_threads,
+                        &result) < 0){
+                fprintf(stderr, "Error : %s/%s did not report\n",
+                        workloads[i].name, allocators[j].name);
+                continue;
+            }
+            bench_print_result(workloads[i].name, allocators[j].name,
+                    &result, json, first);
+            first = 0;
+            fflush(stdout);
+        }
+    }
+
+    if(json)
+        printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,451 @@
+/* malloc() family on top of the memory manager, so that a whole
+ * process, third party libraries included, can run on page families :
+ *
+ * gcc -O2 -fPIC -shared -pthread -ftls-model=initial-exec \
+ *     -fvisibility=hidden -Wl,-Bsymbolic-functions \
+ *     MM_Interposer.c MemoryManager.c glthread.c -o libmm_malloc.so -ldl
+ * LD_PRELOAD=./libmm_malloc.so ./application
+ *
+ * Requests up to MM_INTERPOSER_MAX_CLASS bytes are rounded up to a size
+ * class, each size class being a page family of single unit objects
+ * which the thread caches serve. Bigger requests are counted in 16
+ * byte units of one more family. Pointers the memory manager does not
+ * own, found through the page map, are handed to the next allocator
+ * in the chain, usually glibc. So are requests beyond what a page
+ * family can hold and alignments above the page size.
+ *
+ * Signal handlers which allocate, as bash's SIGCHLD handler does, may
+ * interrupt the memory manager while it holds a family_lock. Nested
+ * allocations go to the next allocator, nested frees are deferred to
+ * the interrupted call.
+ *
+ * -fvisibility=hidden keeps everything but the malloc() family out of
+ * the dynamic symbol table. Exported, our xmalloc(), xcalloc() or
+ * init_glthread() would stand in for the functions of the same name
+ * applications carry, libiberty's xmalloc(size_t) in gcc and binutils
+ * for one. -Bsymbolic-functions keeps our calls into MemoryManager.c
+ * bound to it should the shim be built without it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <sched.h>
+#include <unistd.h>
+#include "UserAPI_MemoryManager.h"
+
+/*The only symbols the shared object exports*/
+#define MM_INTERPOSER_API __attribute__((visibility("default")))
+
+#define MM_INTERPOSER_ALIGN         16
+#define MM_INTERPOSER_MAX_CLASS     1024
+#define MM_INTERPOSER_LARGE_UNIT    16
+/*Bigger requests overflow the 32 bit block sizes of a page family*/
+#define MM_INTERPOSER_MAX_SIZE      ((size_t)3 << 30)
+
+static const uint32_t mm_size_classes[] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024
+};
+
+#define MM_SIZE_CLASSES \
+    (sizeof(mm_size_classes) / sizeof(mm_size_classes[0]))
+
+static mm_family_handle_t mm_size_class_handles[MM_SIZE_CLASSES];
+static mm_family_handle_t mm_large_handle;
+/*Size class index by (size + 15) / 16*/
+static uint8_t mm_size_class_index[MM_INTERPOSER_MAX_CLASS /
+    MM_INTERPOSER_ALIGN + 1];
+
+/*The allocator we stand in front of*/
+static struct {
+    void *(*malloc)(size_t);
+    void *(*calloc)(size_t, size_t);
+    void (*free)(void *);
+    void *(*realloc)(void *, size_t);
+    int (*posix_memalign)(void **, size_t, size_t);
+    size_t (*malloc_usable_size)(void *);
+} mm_next;
+
+/* Allocations made while the interposer initializes itself, dlsym()
+ * and pthread_atfork() among others allocate. Never reused or freed,
+ * every object is preceded by its size*/
+#define MM_BOOTSTRAP_ARENA_SIZE (64 * 1024)
+
+static char mm_bootstrap_arena[MM_BOOTSTRAP_ARENA_SIZE]
+    __attribute__((aligned(MM_INTERPOSER_ALIGN)));
+static size_t mm_bootstrap_used = 0;
+
+typedef enum{
+
+    MM_INTERPOSER_UNINITIALIZED,
+    MM_INTERPOSER_INITIALIZING,
+    MM_INTERPOSER_READY
+} mm_interposer_state_t;
+
+static int mm_interposer_state = MM_INTERPOSER_UNINITIALIZED;
+static __thread int mm_interposer_in_init
+    __attribute__((tls_model("initial-exec")));
+/*Non zero while the thread is inside the memory manager*/
+static __thread int mm_interposer_depth
+    __attribute__((tls_model("initial-exec")));
+/*Objects freed by signal handlers meanwhile, chained on their first word*/
+static __thread void *mm_deferred_frees
+    __attribute__((tls_model("initial-exec")));
+
+static void *
+mm_bootstrap_alloc(size_t size){
+
+    size_t footprint = MM_INTERPOSER_ALIGN +
+        ((size + MM_INTERPOSER_ALIGN - 1) & ~(size_t)(MM_INTERPOSER_ALIGN - 1));
+    size_t offset = __atomic_fetch_add(&mm_bootstrap_used, footprint,
+            __ATOMIC_RELAXED);
+
+    if(size > MM_BOOTSTRAP_ARENA_SIZE ||
+            offset + footprint > MM_BOOTSTRAP_ARENA_SIZE){
+        errno = ENOMEM;
+        return NULL;
+    }
+    *(size_t *)(mm_bootstrap_arena + offset) = size;
+    return mm_bootstrap_arena + offset + MM_INTERPOSER_ALIGN;
+}
+
+static inline int
+mm_is_bootstrap_pointer(void *ptr){
+
+    return (char *)ptr >= mm_bootstrap_arena &&
+        (char *)ptr < mm_bootstrap_arena + MM_BOOTSTRAP_ARENA_SIZE;
+}
+
+static inline size_t
+mm_bootstrap_size(void *ptr){
+
+    return *(size_t *)((char *)ptr - MM_INTERPOSER_ALIGN);
+}
+
+static void
+mm_interposer_init(){
+
+    uint32_t i = 0, size = 0;
+    char struct_name[32];
+
+    mm_init();
+
+    for( ; i < MM_SIZE_CLASSES; i++){
+        snprintf(struct_name, sizeof(struct_name), "mm_size_%u",
+                mm_size_classes[i]);
+        mm_size_class_handles[i] = mm_instantiate_new_page_family(
+                struct_name, mm_size_classes[i]);
+    }
+    mm_large_handle = mm_instantiate_new_page_family("mm_size_large",
+            MM_INTERPOSER_LARGE_UNIT);
+
+    for(i = 0; size <= MM_INTERPOSER_MAX_CLASS; size += MM_INTERPOSER_ALIGN){
+        while(mm_size_classes[i] < size)
+            i++;
+        mm_size_class_index[size / MM_INTERPOSER_ALIGN] = i;
+    }
+
+    mm_next.malloc = dlsym(RTLD_NEXT, "malloc");
+    mm_next.calloc = dlsym(RTLD_NEXT, "calloc");
+    mm_next.free = dlsym(RTLD_NEXT, "free");
+    mm_next.realloc = dlsym(RTLD_NEXT, "realloc");
+    mm_next.posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    mm_next.malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+}
+
+/* Initializes on first use, the first calls can come before any
+ * constructor has run. Returns 0 to a call made by the initialization
+ * itself, which must be served from the bootstrap arena*/
+static inline int
+mm_interposer_ready(){
+
+    int state = __atomic_load_n(&mm_interposer_state, __ATOMIC_ACQUIRE);
+    int expected = MM_INTERPOSER_UNINITIALIZED;
+
+    if(state == MM_INTERPOSER_READY)
+        return 1;
+    if(mm_interposer_in_init)
+        return 0;
+
+    if(__atomic_compare_exchange_n(&mm_interposer_state, &expected,
+                MM_INTERPOSER_INITIALIZING, 0, __ATOMIC_ACQ_REL,
+                __ATOMIC_ACQUIRE)){
+        mm_interposer_in_init = 1;
+        mm_interposer_init();
+        mm_interposer_in_init = 0;
+        __atomic_store_n(&mm_interposer_state, MM_INTERPOSER_READY,
+                __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    while(__atomic_load_n(&mm_interposer_state, __ATOMIC_ACQUIRE) !=
+            MM_INTERPOSER_READY){
+        sched_yield();
+    }
+    return 1;
+}
+
+static void *
+mm_next_alloc(size_t size, int zero){
+
+    if(!mm_next.malloc)
+        return mm_bootstrap_alloc(size);
+    return zero ? mm_next.calloc(1, size) : mm_next.malloc(size);
+}
+
+/* Frees what signal handlers freed while this thread was inside the
+ * memory manager. The list is taken in one go, a handler may push
+ * onto it at any time*/
+static void
+mm_interposer_drain_deferred_frees(){
+
+    void *ptr = NULL;
+    void *next = NULL;
+
+    if(!mm_deferred_frees)
+        return;
+
+    ptr = __atomic_exchange_n(&mm_deferred_frees, NULL, __ATOMIC_RELAXED);
+    mm_interposer_depth++;
+    for( ; ptr; ptr = next){
+        next = *(void **)ptr;
+        xfree(ptr);
+    }
+    mm_interposer_depth--;
+}
+
+/*Page family and no of units serving size bytes, NULL if too big*/
+static inline mm_family_handle_t
+mm_interposer_family(size_t size, int *units){
+
+    *units = 1;
+    if(size <= MM_INTERPOSER_MAX_CLASS){
+        return mm_size_class_handles[mm_size_class_index[
+            (size + MM_INTERPOSER_ALIGN - 1) / MM_INTERPOSER_ALIGN]];
+    }
+    if(size <= MM_INTERPOSER_MAX_SIZE){
+        *units = (int)((size + MM_INTERPOSER_LARGE_UNIT - 1) /
+                MM_INTERPOSER_LARGE_UNIT);
+        return mm_large_handle;
+    }
+    return NULL;
+}
+
+static void *
+mm_interposer_alloc(size_t size, int zero){
+
+    void *ptr = NULL;
+    mm_family_handle_t handle = NULL;
+    int units = 1;
+
+    if(!mm_interposer_ready())
+        return mm_bootstrap_alloc(size);
+
+    if(mm_interposer_depth)
+        return mm_next_alloc(size, zero);
+
+    handle = mm_interposer_family(size, &units);
+    if(!handle)
+        return mm_next_alloc(size, zero);
+
+    mm_interposer_depth++;
+    ptr = zero ? xcalloc_h(handle, units) : xmalloc_h(handle, units);
+    mm_interposer_depth--;
+    mm_interposer_drain_deferred_frees();
+
+    if(!ptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+/*Usable size of any pointer handed out by this process*/
+static size_t
+mm_interposer_usable_size(void *ptr){
+
+    if(mm_owns_pointer(ptr))
+        return xusable_size(ptr);
+    if(mm_is_bootstrap_pointer(ptr))
+        return mm_bootstrap_size(ptr);
+    if(mm_next.malloc_usable_size)
+        return mm_next.malloc_usable_size(ptr);
+    return 0;
+}
+
+MM_INTERPOSER_API void *
+malloc(size_t size){
+
+    return mm_interposer_alloc(size, 0);
+}
+
+MM_INTERPOSER_API void *
+calloc(size_t n, size_t size){
+
+    size_t total = 0;
+
+    if(__builtin_mul_overflow(n, size, &total)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return mm_interposer_alloc(total, 1);
+}
+
+MM_INTERPOSER_API void
+free(void *ptr){
+
+    if(!ptr || mm_is_bootstrap_pointer(ptr))
+        return;
+
+    if(mm_owns_pointer(ptr)){
+        if(mm_interposer_depth){
+            *(void **)ptr = mm_deferred_frees;
+            mm_deferred_frees = ptr;
+            return;
+        }
+        mm_interposer_depth++;
+        xfree(ptr);
+        mm_interposer_depth--;
+        mm_interposer_drain_deferred_frees();
+        return;
+    }
+
+    /*Allocated by the next allocator, or before we were loaded*/
+    mm_interposer_ready();
+    if(mm_next.free)
+        mm_next.free(ptr);
+}
+
+MM_INTERPOSER_API void *
+realloc(void *ptr, size_t size){
+
+    void *new_ptr = NULL;
+    size_t usable_size = 0;
+
+    if(!ptr)
+        return malloc(size);
+
+    if(!size){
+        free(ptr);
+        return NULL;
+    }
+
+    usable_size = mm_interposer_usable_size(ptr);
+
+    /*Shrinks in place unless most of the block would go unused*/
+    if(mm_owns_pointer(ptr) && size <= usable_size && size >= usable_size / 2)
+        return ptr;
+
+    /*Large objects stay in their page family, which grows them in place*/
+    if(size > MM_INTERPOSER_MAX_CLASS && size <= MM_INTERPOSER_MAX_SIZE &&
+            !mm_interposer_depth &&
+            mm_get_page_family_handle_of(ptr) == mm_large_handle){
+        mm_interposer_depth++;
+        new_ptr = xrealloc(ptr, (int)((size + MM_INTERPOSER_LARGE_UNIT - 1) /
+                    MM_INTERPOSER_LARGE_UNIT));
+        mm_interposer_depth--;
+        mm_interposer_drain_deferred_frees();
+
+        if(!new_ptr)
+            errno = ENOMEM;
+        return new_ptr;
+    }
+
+    if(!mm_owns_pointer(ptr) && !mm_is_bootstrap_pointer(ptr) &&
+            size > MM_INTERPOSER_MAX_SIZE && mm_next.realloc){
+        return mm_next.realloc(ptr, size);
+    }
+
+    new_ptr = malloc(size);
+    if(!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, usable_size < size ? usable_size : size);
+    free(ptr);
+    return new_ptr;
+}
+
+MM_INTERPOSER_API int
+posix_memalign(void **memptr, size_t alignment, size_t size){
+
+    void *ptr = NULL;
+    mm_family_handle_t handle = NULL;
+    int units = 1;
+
+    if(!alignment || (alignment & (alignment - 1)) ||
+            alignment % sizeof(void *)){
+        return EINVAL;
+    }
+
+    if(alignment <= MM_INTERPOSER_ALIGN){
+        *memptr = malloc(size);
+        return *memptr ? 0 : ENOMEM;
+    }
+
+    if(!mm_interposer_ready())
+        return ENOMEM;
+
+    handle = mm_interposer_family(size, &units);
+    if(handle && !mm_interposer_depth &&
+            alignment <= (size_t)getpagesize()){
+        mm_interposer_depth++;
+        ptr = xmalloc_aligned(handle, units, (uint32_t)alignment);
+        mm_interposer_depth--;
+        mm_interposer_drain_deferred_frees();
+
+        if(!ptr)
+            return ENOMEM;
+        *memptr = ptr;
+        return 0;
+    }
+
+    if(!mm_next.posix_memalign)
+        return ENOMEM;
+    return mm_next.posix_memalign(memptr, alignment, size);
+}
+
+MM_INTERPOSER_API void *
+aligned_alloc(size_t alignment, size_t size){
+
+    void *ptr = NULL;
+    int rc = posix_memalign(&ptr, alignment < sizeof(void *) ?
+            sizeof(void *) : alignment, size);
+
+    if(rc){
+        errno = rc;
+        return NULL;
+    }
+    return ptr;
+}
+
+MM_INTERPOSER_API void *
+memalign(size_t alignment, size_t size){
+
+    return aligned_alloc(alignment, size);
+}
+
+MM_INTERPOSER_API void *
+valloc(size_t size){
+
+    return aligned_alloc(getpagesize(), size);
+}
+
+MM_INTERPOSER_API void *
+pvalloc(size_t size){
+
+    size_t page_size = getpagesize();
+
+    return aligned_alloc(page_size,
+            (size + page_size - 1) & ~(page_size - 1));
+}
+
+MM_INTERPOSER_API size_t
+malloc_usable_size(void *ptr){
+
+    if(!ptr)
+        return 0;
+    return mm_interposer_usable_size(ptr);
+}
@@ -1,31 +1,271 @@
+#define _GNU_SOURCE    /*mremap, sched_getcpu*/
 #include <stdio.h>
+#include <stdlib.h>     /*qsort*/
+#include <stdarg.h>
 #include <memory.h>
 #include <unistd.h>     /*for getpagesize*/
 #include <sys/mman.h>   /*For using mmap()*/
 #include <stdint.h>
+#include <inttypes.h>   /*PRIu64*/
 #include "MemoryManager.h"
+#include "UserAPI_MemoryManager.h"
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>       /*clock_gettime*/
+#include <sched.h>      /*sched_yield*/
+#include <sys/syscall.h>
+#include <fcntl.h>      /*open*/
+#include <errno.h>
 #include "css.h"
 
 static vm_page_for_families_t *first_vm_page_for_families = NULL;
 static size_t SYSTEM_PAGE_SIZE = 0;
+static uint32_t mm_direct_mmap_threshold = MM_DEFAULT_DIRECT_MMAP_THRESHOLD;
+static uint32_t mm_purge_threshold = MM_DEFAULT_PURGE_THRESHOLD;
+#ifdef MADV_FREE
+static int mm_purge_advice = MADV_FREE;
+#else
+static int mm_purge_advice = MADV_DONTNEED;
+#endif
+
+/* Empty single page VM pages shared by all page families, chained on
+ * their next pointer*/
+static vm_page_t *mm_global_page_cache[MM_MAX_NUMA_NODES];
+static uint32_t mm_global_page_cache_count = 0;    /*all nodes together*/
+static uint64_t mm_global_page_cache_hits = 0;
+static pthread_mutex_t mm_global_page_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t mm_family_page_cache_max = MM_DEFAULT_FAMILY_PAGE_CACHE_MAX;
+static uint32_t mm_global_page_cache_max = MM_DEFAULT_GLOBAL_PAGE_CACHE_MAX;
+
+static mm_huge_page_mode_t mm_huge_page_mode = MM_HUGE_PAGE_NONE;
+static mm_huge_region_t *mm_available_huge_regions = NULL;
+static uint32_t mm_huge_region_count = 0;
+static pthread_mutex_t mm_huge_region_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t mm_next_family_id = 0;
+static uint64_t mm_next_registration = 0;
+
+static int mm_latency_tracking = 0;
+
+/*Allocation trace, the ring is mapped by the first mm_trace_start()*/
+static mm_trace_ring_t *mm_trace_ring = NULL;
+static int mm_tracing = 0;
+static uint32_t mm_trace_writers = 0;  /*producers past the mm_tracing check*/
+static uint64_t mm_trace_dropped = 0;
+static int mm_trace_flusher_run = 0;
+/*Written with plain write(2), a forked child inherits no buffered events*/
+static int mm_trace_fd = -1;
+static pthread_t mm_trace_flusher;
+/*Serializes mm_trace_start() and mm_trace_stop()*/
+static pthread_mutex_t mm_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint32_t mm_trace_thread_id = 0;
+
+/*Root of the page map, leaves hold one mm_page_kind_t byte per 4 KB*/
+static uint8_t *mm_page_map[1 << MM_PAGE_MAP_ROOT_BITS];
+
+/*Registry hash index on struct_name*/
+static vm_page_family_t **mm_family_hash_buckets = NULL;
+static uint32_t mm_family_hash_bucket_count = 0;
+static uint32_t mm_registered_family_count = 0;
+/*Slots released by mm_unregister_page_family, chained on hash_next*/
+static vm_page_family_t *mm_free_family_slots = NULL;
+
+/* Guards the registry : registration and unregistration take it for
+ * writing, lookups and introspection for reading. Every page family
+ * serializes its own pages and free blocks with its family_lock*/
+static pthread_rwlock_t mm_registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static __thread mm_tcache_t mm_tcache;
+static pthread_key_t mm_tcache_key;
+static pthread_once_t mm_tcache_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_once_t mm_atfork_once = PTHREAD_ONCE_INIT;
+static void mm_atfork_register();
+
+static uint32_t mm_numa_nodes = 1;          /*of the machine, folded*/
+static uint32_t mm_numa_fake_nodes = 0;
+static uint8_t mm_numa_cpu_node[MM_NUMA_MAX_CPUS];
+static uint64_t mm_numa_pages_mapped[MM_MAX_NUMA_NODES];
+static __thread int mm_numa_thread_node = -1;
+static pthread_once_t mm_numa_once = PTHREAD_ONCE_INIT;
+static void mm_numa_init();
 
 void
 mm_init(){
 
     SYSTEM_PAGE_SIZE = getpagesize();
+    pthread_once(&mm_atfork_once, mm_atfork_register);
+    pthread_once(&mm_numa_once, mm_numa_init);
 }
 
+/* Maps the CPUs of a sysfs cpulist such as "0-3,8,10-11" to the node.
+ * Read with plain syscalls, malloc may be the one being initialized*/
+static void
+mm_numa_read_cpulist(uint32_t node, char *cpulist){
+
+    char *p = cpulist;
+    uint32_t first = 0, last = 0, cpu = 0;
+
+    while(*p >= '0' && *p <= '9'){
+
+        first = strtoul(p, &p, 10);
+        last = first;
+        if(*p == '-')
+            last = strtoul(p + 1, &p, 10);
+        for(cpu = first; cpu <= last && cpu < MM_NUMA_MAX_CPUS; cpu++)
+            mm_numa_cpu_node[cpu] = node % MM_MAX_NUMA_NODES;
+        if(*p == ',')
+            p++;
+    }
+}
+
+static void
+mm_numa_init(){
+
+    int fd = -1;
+    ssize_t len = 0;
+    uint32_t node = 0;
+    char path[64];
+    char cpulist[512];
+
+    /*Node ids are assumed dense, as the kernel hands them out*/
+    for( ; ; node++){
+
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/node/node%u/cpulist", node);
+        fd = open(path, O_RDONLY);
+        if(fd < 0)
+            break;
+        len = read(fd, cpulist, sizeof(cpulist) - 1);
+        close(fd);
+        cpulist[len > 0 ? len : 0] = '\0';
+        mm_numa_read_cpulist(node, cpulist);
+    }
+
+    if(node > MM_MAX_NUMA_NODES)
+        node = MM_MAX_NUMA_NODES;
+    mm_numa_nodes = node ? node : 1;
+}
+
+uint32_t
+mm_numa_node_count(){
+
+    return mm_numa_fake_nodes ? mm_numa_fake_nodes : mm_numa_nodes;
+}
+
+void
+mm_numa_set_fake_topology(uint32_t node_count){
+
+    if(node_count > MM_MAX_NUMA_NODES)
+        node_count = MM_MAX_NUMA_NODES;
+    mm_numa_fake_nodes = node_count;
+}
+
+void
+mm_numa_set_thread_node(int node){
+
+    mm_numa_thread_node = node;
+}
+
+/*Node whose free lists the calling thread allocates from*/
+static inline uint32_t
+mm_numa_current_node(){
+
+    int cpu = 0;
+    uint32_t node_count = mm_numa_node_count();
+
+    if(node_count == 1)
+        return 0;
+    if(mm_numa_thread_node >= 0)
+        return (uint32_t)mm_numa_thread_node % node_count;
+
+    cpu = sched_getcpu();
+    if(cpu < 0)
+        return 0;
+    if(mm_numa_fake_nodes)
+        return (uint32_t)cpu % node_count;
+    return cpu < MM_NUMA_MAX_CPUS ? mm_numa_cpu_node[cpu] : 0;
+}
+
+/* Asks the kernel to back the fresh mapping with memory of the node,
+ * before any of it is touched. A folded node stands for the lowest
+ * node it was folded from. The policy is a hint, failures are
+ * ignored*/
+static void
+mm_numa_bind(void *addr, uint32_t units, uint32_t node){
+
+    unsigned long node_mask = 1UL << node;
+
+    if(mm_numa_fake_nodes || mm_numa_nodes == 1)
+        return;
+    syscall(SYS_mbind, addr, (unsigned long)units * SYSTEM_PAGE_SIZE,
+            MM_MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8, 0);
+}
+
+/* Size of the block holding req_size bytes : the footprint is rounded
+ * up to MM_BLOCK_ALIGN and big enough for the free block meta data*/
+static inline uint32_t
+mm_block_size_for_request(uint32_t req_size){
+
+    uint32_t footprint = (req_size + sizeof(block_meta_data_t) +
+            MM_BLOCK_ALIGN - 1) & ~(MM_BLOCK_ALIGN - 1);
+
+    if(footprint < MM_MIN_BLOCK_FOOTPRINT)
+        footprint = MM_MIN_BLOCK_FOOTPRINT;
+    return footprint - sizeof(block_meta_data_t);
+}
+
+/* Size of the block holding req_size bytes in the page family. The
+ * footprint is rounded up to the family alignment, so that the block
+ * carved next to it starts aligned as well*/
+static inline uint32_t
+mm_family_block_size(vm_page_family_t *vm_page_family, uint32_t req_size){
+
+    uint32_t footprint = (req_size + sizeof(block_meta_data_t) +
+            vm_page_family->align - 1) & ~(vm_page_family->align - 1);
+
+    if(footprint < MM_MIN_BLOCK_FOOTPRINT)
+        footprint = MM_MIN_BLOCK_FOOTPRINT;
+    return footprint - sizeof(block_meta_data_t);
+}
+
+/* The block of an empty VM page ends one header short of the page end,
+ * so that its footprint stays a multiple of MM_BLOCK_ALIGN*/
 static inline uint32_t
 mm_max_page_allocatable_memory(int units){
 
     return (uint32_t)
-        ((SYSTEM_PAGE_SIZE * units) - offset_of(vm_page_t, page_memory));
+        ((SYSTEM_PAGE_SIZE * units) - offset_of(vm_page_t, page_memory)
+         - sizeof(block_meta_data_t));
 }
 
 #define MAX_PAGE_ALLOCATABLE_MEMORY(units) \
     (mm_max_page_allocatable_memory(units))
 
+/*No of system pages a VM page needs to hold a block of req_size bytes*/
+static inline uint32_t
+mm_page_units_for_request(uint32_t req_size){
+
+    return (uint32_t)((mm_block_size_for_request(req_size) +
+                offset_of(vm_page_t, page_memory) + sizeof(block_meta_data_t) +
+                SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE);
+}
+
+/* Spans served below the threshold are limited to MM_MAX_SPAN_SIZE by
+ * the block offsets, so the threshold is capped accordingly*/
+void
+mm_set_direct_mmap_threshold(uint32_t threshold){
+
+    if(threshold > MM_MAX_SPAN_SIZE - SYSTEM_PAGE_SIZE)
+        threshold = MM_MAX_SPAN_SIZE - SYSTEM_PAGE_SIZE;
+    mm_direct_mmap_threshold = threshold;
+}
+
+void
+mm_set_purge_threshold(uint32_t threshold){
+
+    mm_purge_threshold = threshold;
+}
+
 
 /*Function to request VM page from kernel*/
 static void *
@@ -42,7 +282,7 @@ mm_get_new_vm_page_from_kernel(int units){
         printf("Error : VM Page allocation Failed\n");
         return NULL;
     }
-    memset(vm_page, 0, units * SYSTEM_PAGE_SIZE);
+    /*Anonymous mappings are zero filled by the kernel already*/
     return (void *)vm_page;
 }
 
@@ -56,498 +296,3471 @@ mm_return_vm_page_to_kernel (void *vm_page, int units){
     }
 }
 
-static int
-mm_get_hard_internal_memory_frag_size(
-        block_meta_data_t *first,
-        block_meta_data_t *second){
+static inline mm_page_kind_t
+mm_page_map_get(void *addr){
 
-    block_meta_data_t *next_block = NEXT_META_BLOCK_BY_SIZE(first);
-    return (int)((unsigned long)second - (unsigned long)(next_block));
+    uintptr_t page_no = (uintptr_t)addr >> MM_PAGE_MAP_PAGE_SHIFT;
+    uint8_t *leaf = NULL;
+
+    if((uintptr_t)addr >> MM_PAGE_MAP_ADDRESS_BITS)
+        return MM_PAGE_KIND_NONE;
+
+    leaf = __atomic_load_n(&mm_page_map[page_no >> MM_PAGE_MAP_LEAF_BITS],
+            __ATOMIC_ACQUIRE);
+    if(!leaf)
+        return MM_PAGE_KIND_NONE;
+
+    return (mm_page_kind_t)__atomic_load_n(
+            &leaf[page_no & ((1 << MM_PAGE_MAP_LEAF_BITS) - 1)],
+            __ATOMIC_RELAXED);
 }
 
+/* Records the kind of the 'units' system pages starting at addr,
+ * mapping the leaves on the way. Leaves are never unmapped, so
+ * readers need no lock*/
+static vm_bool_t
+mm_page_map_set(void *addr, uint32_t units, mm_page_kind_t kind){
+
+    uintptr_t page_no = (uintptr_t)addr >> MM_PAGE_MAP_PAGE_SHIFT;
+    uintptr_t end_page_no = page_no +
+        ((units * SYSTEM_PAGE_SIZE) >> MM_PAGE_MAP_PAGE_SHIFT);
+    uint8_t **root_slot = NULL;
+    uint8_t *leaf = NULL;
+    uint8_t *expected = NULL;
 
-static void
-mm_union_free_blocks(block_meta_data_t *first,
-        block_meta_data_t *second){
+    if(((uintptr_t)addr + units * SYSTEM_PAGE_SIZE) >> MM_PAGE_MAP_ADDRESS_BITS){
+        printf("Error : Address %p out of the page map range\n", addr);
+        return MM_FALSE;
+    }
 
-    assert(first->is_free == MM_TRUE &&
-            second->is_free == MM_TRUE);
+    for( ; page_no < end_page_no; page_no++){
 
-    first->block_size += sizeof(block_meta_data_t) +
-        second->block_size;
+        root_slot = &mm_page_map[page_no >> MM_PAGE_MAP_LEAF_BITS];
+        leaf = __atomic_load_n(root_slot, __ATOMIC_ACQUIRE);
+
+        if(!leaf){
+            leaf = mmap(0, 1 << MM_PAGE_MAP_LEAF_BITS, PROT_READ|PROT_WRITE,
+                    MAP_ANON|MAP_PRIVATE, 0, 0);
+            if(leaf == MAP_FAILED){
+                printf("Error : Page map leaf allocation Failed\n");
+                return MM_FALSE;
+            }
+            expected = NULL;
+            if(!__atomic_compare_exchange_n(root_slot, &expected, leaf, MM_FALSE,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+                /*Lost the race against another thread*/
+                munmap(leaf, 1 << MM_PAGE_MAP_LEAF_BITS);
+                leaf = expected;
+            }
+        }
+        /* An address unmapped by one family may be mapped again by
+         * another at once, under a different family_lock*/
+        __atomic_store_n(&leaf[page_no & ((1 << MM_PAGE_MAP_LEAF_BITS) - 1)],
+                (uint8_t)kind, __ATOMIC_RELAXED);
+    }
+    return MM_TRUE;
+}
 
-    first->next_block = second->next_block;
+void
+mm_set_latency_tracking(int enable){
 
-    if(second->next_block)
-        second->next_block->prev_block = first;
+    __atomic_store_n(&mm_latency_tracking, enable, __ATOMIC_RELAXED);
 }
 
-vm_page_t *
-allocate_vm_page(vm_page_family_t *vm_page_family){
+static inline uint64_t
+mm_clock_ns(){
 
-    vm_page_t *vm_page = mm_get_new_vm_page_from_kernel(1);
-   
-    /*Initialize lower most Meta block of the VM page*/
-    MARK_VM_PAGE_EMPTY(vm_page);
+    struct timespec ts;
 
-    vm_page->block_meta_data.block_size =
-        mm_max_page_allocatable_memory(1);
-    vm_page->block_meta_data.offset =
-        offset_of(vm_page_t, block_meta_data);
-    init_glthread(&vm_page->block_meta_data.priority_thread_glue);
-    vm_page->next = NULL;
-    vm_page->prev = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    /*Set the back pointer to page family*/
-    vm_page->pg_family = vm_page_family;
+/*Start time of a timed operation, 0 while tracking is off*/
+static inline uint64_t
+mm_latency_start(){
 
-    /*If it is a first VM data page for a given
-     * page family*/
-    if(!vm_page_family->first_page){
-        vm_page_family->first_page = vm_page;
-        return vm_page;
-    }
+    if(!__atomic_load_n(&mm_latency_tracking, __ATOMIC_RELAXED))
+        return 0;
 
-    /* Insert new VM page to the head of the linked 
-     * list*/
-    vm_page->next = vm_page_family->first_page;
-    vm_page_family->first_page->prev = vm_page;
-    vm_page_family->first_page = vm_page;
-    return vm_page;
+    return mm_clock_ns();
 }
 
-void
-mm_vm_page_delete_and_free(
-        vm_page_t *vm_page){
+static inline uint32_t
+mm_latency_bucket_index(uint64_t latency_ns){
 
-    vm_page_family_t *vm_page_family =
-        vm_page->pg_family;
+    uint32_t exponent = 0;
 
-    /*If the page being deleted is the head of the linked 
-     * list*/
-    if(vm_page_family->first_page == vm_page){
-        vm_page_family->first_page = vm_page->next;
-        if(vm_page->next)
-            vm_page->next->prev = NULL;
-        vm_page->next = NULL;
-        vm_page->prev = NULL;
-        mm_return_vm_page_to_kernel((void *)vm_page, 1);
+    if(latency_ns < MM_LATENCY_SUB_BUCKETS)
+        return (uint32_t)latency_ns;
+
+    exponent = 63 - __builtin_clzll(latency_ns);
+    return (exponent - MM_LATENCY_SUB_BUCKET_BITS + 1) * MM_LATENCY_SUB_BUCKETS +
+        (uint32_t)((latency_ns >> (exponent - MM_LATENCY_SUB_BUCKET_BITS)) &
+                (MM_LATENCY_SUB_BUCKETS - 1));
+}
+
+static mm_latency_histograms_t *
+mm_latency_histograms_get(vm_page_family_t *vm_page_family){
+
+    uint32_t units = 0;
+    mm_latency_histograms_t *latency_histograms = NULL;
+    mm_latency_histograms_t *expected = NULL;
+
+    latency_histograms = __atomic_load_n(&vm_page_family->latency_histograms,
+            __ATOMIC_ACQUIRE);
+    if(latency_histograms)
+        return latency_histograms;
+
+    units = (sizeof(mm_latency_histograms_t) + SYSTEM_PAGE_SIZE - 1) /
+        SYSTEM_PAGE_SIZE;
+    latency_histograms = mm_get_new_vm_page_from_kernel(units);
+    if(!latency_histograms)
+        return NULL;
+
+    if(!__atomic_compare_exchange_n(&vm_page_family->latency_histograms,
+                &expected, latency_histograms, MM_FALSE,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        /*Another thread installed them first*/
+        mm_return_vm_page_to_kernel(latency_histograms, units);
+        latency_histograms = expected;
+    }
+    return latency_histograms;
+}
+
+/* Records the time elapsed since start_ns. Samples are added with
+ * relaxed atomics since allocations served by the thread caches do
+ * not hold the family_lock. Operations during which tracking was
+ * turned on or off are not recorded*/
+static void
+mm_latency_record(vm_page_family_t *vm_page_family, mm_latency_op_t op,
+        uint64_t start_ns){
+
+    uint64_t end_ns = 0;
+    uint64_t latency_ns = 0;
+    uint64_t max_ns = 0;
+    mm_latency_histogram_t *histogram = NULL;
+    mm_latency_histograms_t *latency_histograms = NULL;
+
+    if(!start_ns || !vm_page_family)
+        return;
+
+    end_ns = mm_latency_start();
+    if(!end_ns)
         return;
+    latency_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+
+    latency_histograms = mm_latency_histograms_get(vm_page_family);
+    if(!latency_histograms)
+        return;
+
+    histogram = &latency_histograms->op[op];
+    __atomic_fetch_add(&histogram->buckets[mm_latency_bucket_index(latency_ns)],
+            1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+
+    max_ns = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while(latency_ns > max_ns &&
+            !__atomic_compare_exchange_n(&histogram->max_ns, &max_ns,
+                latency_ns, MM_TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Claims a slot of the trace ring, returns NULL if the ring is full.
+ * Producers reserve positions with a CAS on tail, a slot is theirs
+ * once its seq has come round to their position*/
+static mm_trace_slot_t *
+mm_trace_ring_claim(mm_trace_ring_t *ring, uint64_t *pos){
+
+    int64_t diff = 0;
+    mm_trace_slot_t *slot = NULL;
+
+    *pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for( ; ; ){
+        slot = &ring->slots[*pos & (MM_TRACE_RING_EVENTS - 1)];
+        diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - *pos);
+        if(diff == 0){
+            if(__atomic_compare_exchange_n(&ring->tail, pos, *pos + 1,
+                        MM_TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return slot;
+        }
+        else if(diff < 0){
+            /*Not drained yet by the flusher*/
+            return NULL;
+        }
+        else {
+            *pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
     }
+}
 
-    /*If we are deleting the page from middle or end of 
-     * linked list*/
-    if(vm_page->next)
-        vm_page->next->prev = vm_page->prev;
-    vm_page->prev->next = vm_page->next;
-    mm_return_vm_page_to_kernel((void *)vm_page, 1);
+static void
+mm_trace_record(mm_trace_event_type_t type, uint16_t flags,
+        vm_page_family_t *vm_page_family, uint32_t units, void *ptr){
+
+    uint64_t pos = 0;
+    uint32_t retries = 0;
+    mm_trace_slot_t *slot = NULL;
+
+    /*mm_trace_stop() waits for every writer which saw tracing on*/
+    __atomic_fetch_add(&mm_trace_writers, 1, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&mm_tracing, __ATOMIC_SEQ_CST)){
+
+        /*A full ring makes the producer give way to the flusher first*/
+        while(!(slot = mm_trace_ring_claim(mm_trace_ring, &pos)) &&
+                retries++ < MM_TRACE_FULL_RETRIES){
+            sched_yield();
+        }
+        if(slot){
+            if(!mm_trace_thread_id)
+                mm_trace_thread_id = (uint32_t)syscall(SYS_gettid);
+
+            slot->event.timestamp_ns = mm_clock_ns();
+            slot->event.ptr_id = (uint64_t)(uintptr_t)ptr;
+            slot->event.thread_id = mm_trace_thread_id;
+            slot->event.family_id = vm_page_family->family_id;
+            slot->event.units = units;
+            slot->event.type = (uint16_t)type;
+            slot->event.flags = flags;
+            __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        }
+        else {
+            __atomic_fetch_add(&mm_trace_dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_fetch_sub(&mm_trace_writers, 1, __ATOMIC_RELEASE);
 }
 
-void
-mm_print_vm_page_details(vm_page_t *vm_page){
+/*Costs a single relaxed load while tracing is off*/
+static inline void
+mm_trace(mm_trace_event_type_t type, uint16_t flags,
+        vm_page_family_t *vm_page_family, uint32_t units, void *ptr){
 
-    printf("\t\t next = %p, prev = %p\n", vm_page->next, vm_page->prev);
-    printf("\t\t page family = %s\n", vm_page->pg_family->struct_name);
+    if(__atomic_load_n(&mm_tracing, __ATOMIC_RELAXED))
+        mm_trace_record(type, flags, vm_page_family, units, ptr);
+}
 
-    uint32_t j = 0;
-    block_meta_data_t *curr;
-    ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page, curr){
+static void
+mm_trace_write(const void *buf, size_t size){
 
-        printf("\t\t\t%-14p Block %-3u %s  block_size = %-6u  "
-                "offset = %-6u  prev = %-14p  next = %p\n",
-                curr,
-                j++, curr->is_free ? "F R E E D" : "ALLOCATED",
-                curr->block_size, curr->offset,
-                curr->prev_block,
-                curr->next_block);
-    } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page, curr);
+    ssize_t written = 0;
+
+    while(size){
+        written = write(mm_trace_fd, buf, size);
+        if(written <= 0)
+            return;
+        buf = (const char *)buf + written;
+        size -= written;
+    }
 }
 
+/*Writes the events published so far to the trace file*/
+static void
+mm_trace_drain(){
+
+    uint32_t count = 0;
+    mm_trace_slot_t *slot = NULL;
+    mm_trace_ring_t *ring = mm_trace_ring;
+    mm_trace_event_t batch[256];
+
+    for( ; ; ){
+        slot = &ring->slots[ring->head & (MM_TRACE_RING_EVENTS - 1)];
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head + 1)
+            break;
+        batch[count++] = slot->event;
+        /*Free again for the producer one lap ahead*/
+        __atomic_store_n(&slot->seq, ring->head + MM_TRACE_RING_EVENTS,
+                __ATOMIC_RELEASE);
+        ring->head++;
+        if(count == sizeof(batch) / sizeof(batch[0])){
+            mm_trace_write(batch, sizeof(batch[0]) * count);
+            count = 0;
+        }
+    }
+    if(count)
+        mm_trace_write(batch, sizeof(batch[0]) * count);
+}
 
+static void *
+mm_trace_flusher_fn(void *arg){
 
+    struct timespec pause = {0, 1000000};
 
-void
-mm_instantiate_new_page_family(
-    char *struct_name,
-    uint32_t struct_size){
+    (void)arg;
+    while(__atomic_load_n(&mm_trace_flusher_run, __ATOMIC_ACQUIRE)){
+        mm_trace_drain();
+        nanosleep(&pause, NULL);
+    }
+    mm_trace_drain();
+    return NULL;
+}
 
+int
+mm_trace_start(const char *path){
 
+    uint32_t i = 0;
+    mm_trace_file_header_t header;
     vm_page_family_t *vm_page_family_curr = NULL;
-    vm_page_for_families_t *new_vm_page_for_families = NULL;
 
-    if(struct_size > SYSTEM_PAGE_SIZE){
-        
-        printf("Error : %s() Structure %s Size exceeds system page size\n",
-            __FUNCTION__, struct_name);
-        return;
+    pthread_mutex_lock(&mm_trace_lock);
+
+    if(mm_trace_fd >= 0){
+        pthread_mutex_unlock(&mm_trace_lock);
+        printf("Error : %s() Tracing is on already\n", __FUNCTION__);
+        return -1;
     }
 
-    if(!first_vm_page_for_families){
+    if(!mm_trace_ring){
+        mm_trace_ring = mm_get_new_vm_page_from_kernel(
+                (sizeof(mm_trace_ring_t) + SYSTEM_PAGE_SIZE - 1) /
+                SYSTEM_PAGE_SIZE);
+        if(!mm_trace_ring){
+            pthread_mutex_unlock(&mm_trace_lock);
+            return -1;
+        }
+    }
 
-        first_vm_page_for_families = 
-            (vm_page_for_families_t *)mm_get_new_vm_page_from_kernel(1);
-        first_vm_page_for_families->next = NULL;
-        strncpy(first_vm_page_for_families->vm_page_family[0].struct_name, 
-        struct_name, MM_MAX_STRUCT_NAME);
-        first_vm_page_for_families->vm_page_family[0].struct_size = struct_size;
-        first_vm_page_for_families->vm_page_family[0].first_page = NULL;
-        init_glthread(&first_vm_page_for_families->vm_page_family[0].free_block_priority_list_head);
-        return;
+    mm_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(mm_trace_fd < 0){
+        pthread_mutex_unlock(&mm_trace_lock);
+        printf("Error : %s() Cannot open %s\n", __FUNCTION__, path);
+        return -1;
     }
 
-	vm_page_family_curr = lookup_page_family_by_name(struct_name);
+    memset(&header, 0, sizeof(header));
+    header.magic = MM_TRACE_MAGIC;
+    header.event_size = sizeof(mm_trace_event_t);
+    mm_trace_write(&header, sizeof(header));
+
+    mm_trace_ring->head = 0;
+    mm_trace_ring->tail = 0;
+    for( ; i < MM_TRACE_RING_EVENTS; i++)
+        mm_trace_ring->slots[i].seq = i;
+    mm_trace_dropped = 0;
+
+    __atomic_store_n(&mm_trace_flusher_run, 1, __ATOMIC_RELEASE);
+    if(pthread_create(&mm_trace_flusher, NULL, mm_trace_flusher_fn, NULL)){
+        close(mm_trace_fd);
+        mm_trace_fd = -1;
+        pthread_mutex_unlock(&mm_trace_lock);
+        printf("Error : %s() Cannot start the flusher thread\n", __FUNCTION__);
+        return -1;
+    }
 
-	if(vm_page_family_curr) {
-		assert(0);
-	}
+    /* Families registered so far go first. Registrations record
+     * themselves under the registry write lock, so none is missed or
+     * recorded twice*/
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    __atomic_store_n(&mm_tracing, 1, __ATOMIC_SEQ_CST);
 
-    uint32_t count = 0;
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families,
+            vm_page_family_curr){
+
+        mm_trace_record(MM_TRACE_REGISTER, vm_page_family_curr->flags,
+                vm_page_family_curr, vm_page_family_curr->struct_size,
+                (void *)(uintptr_t)vm_page_family_curr->align);
+
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families,
+            vm_page_family_curr);
+    pthread_rwlock_unlock(&mm_registry_lock);
 
-    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+    pthread_mutex_unlock(&mm_trace_lock);
+    return 0;
+}
 
-	    count++;
+uint64_t
+mm_trace_stop(){
 
-    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    uint64_t dropped = 0;
 
-    if(count == MAX_FAMILIES_PER_VM_PAGE){
+    pthread_mutex_lock(&mm_trace_lock);
 
-        new_vm_page_for_families = 
-            (vm_page_for_families_t *)mm_get_new_vm_page_from_kernel(1);
-        new_vm_page_for_families->next = first_vm_page_for_families;
-        first_vm_page_for_families = new_vm_page_for_families;
+    if(mm_trace_fd < 0){
+        pthread_mutex_unlock(&mm_trace_lock);
+        return 0;
     }
 
-    strncpy(vm_page_family_curr->struct_name, struct_name,
-            MM_MAX_STRUCT_NAME);
-    vm_page_family_curr->struct_size = struct_size;
-    vm_page_family_curr->first_page = NULL;
-    init_glthread(&vm_page_family_curr->free_block_priority_list_head);
+    __atomic_store_n(&mm_tracing, 0, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&mm_trace_writers, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    /*Every claimed slot is published now, the flusher drains them last*/
+    __atomic_store_n(&mm_trace_flusher_run, 0, __ATOMIC_RELEASE);
+    pthread_join(mm_trace_flusher, NULL);
+
+    close(mm_trace_fd);
+    mm_trace_fd = -1;
+    dropped = mm_trace_dropped;
+
+    pthread_mutex_unlock(&mm_trace_lock);
+    return dropped;
 }
 
 void
-mm_print_registered_page_families(){
+mm_set_huge_page_mode(mm_huge_page_mode_t mode){
 
-    vm_page_family_t *vm_page_family_curr = NULL;
-    vm_page_for_families_t *vm_page_for_families_curr = NULL;
+    mm_huge_page_mode = mode;
+}
+
+/* Maps a new MM_HUGE_PAGE_SIZE aligned region. Explicit huge pages
+ * are aligned by the kernel, otherwise a double sized mapping is
+ * trimmed down to the aligned part and advised for THP*/
+static mm_huge_region_t *
+mm_huge_region_create(){
+
+    char *vm_region = MAP_FAILED;
+    char *aligned_vm_region = NULL;
+    mm_huge_region_t *huge_region = NULL;
+
+#ifdef MAP_HUGETLB
+    if(mm_huge_page_mode == MM_HUGE_PAGE_EXPLICIT){
+        vm_region = mmap(0, MM_HUGE_PAGE_SIZE,
+                PROT_READ|PROT_WRITE|PROT_EXEC,
+                MAP_ANON|MAP_PRIVATE|MAP_HUGETLB, 0, 0);
+    }
+#endif
 
-    for(vm_page_for_families_curr = first_vm_page_for_families;
-            vm_page_for_families_curr;
-            vm_page_for_families_curr = vm_page_for_families_curr->next){
+    if(vm_region != MAP_FAILED){
+        aligned_vm_region = vm_region;
+    }
+    else {
+        vm_region = mmap(0, 2 * MM_HUGE_PAGE_SIZE,
+                PROT_READ|PROT_WRITE|PROT_EXEC,
+                MAP_ANON|MAP_PRIVATE, 0, 0);
+
+        if(vm_region == MAP_FAILED){
+            printf("Error : Huge page region allocation Failed\n");
+            return NULL;
+        }
+
+        aligned_vm_region = (char *)MM_HUGE_REGION_FROM_CHUNK(
+                vm_region + MM_HUGE_PAGE_SIZE - 1);
+        if(aligned_vm_region != vm_region)
+            munmap(vm_region, aligned_vm_region - vm_region);
+        munmap(aligned_vm_region + MM_HUGE_PAGE_SIZE,
+                vm_region + MM_HUGE_PAGE_SIZE - aligned_vm_region);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned_vm_region, MM_HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+
+    huge_region = (mm_huge_region_t *)aligned_vm_region;
+    huge_region->next = NULL;
+    huge_region->prev = NULL;
+    huge_region->free_chunks = NULL;
+    huge_region->chunk_count = MM_HUGE_PAGE_SIZE / SYSTEM_PAGE_SIZE;
+    /*Chunk 0 holds the region header*/
+    huge_region->next_unused_chunk = 1;
+    huge_region->chunks_in_use = 0;
+    huge_region->is_available = MM_FALSE;
+    return huge_region;
+}
 
-        ITERATE_PAGE_FAMILIES_BEGIN(vm_page_for_families_curr,
-                vm_page_family_curr){
+static void
+mm_huge_region_set_available(mm_huge_region_t *huge_region,
+        vm_bool_t is_available){
 
-            printf("Page Family : %s, Size = %u\n",
-                    vm_page_family_curr->struct_name,
-                    vm_page_family_curr->struct_size);
+    if(huge_region->is_available == is_available)
+        return;
 
-        } ITERATE_PAGE_FAMILIES_END(vm_page_for_families_curr,
-                vm_page_family_curr);
+    if(is_available){
+        huge_region->prev = NULL;
+        huge_region->next = mm_available_huge_regions;
+        if(mm_available_huge_regions)
+            mm_available_huge_regions->prev = huge_region;
+        mm_available_huge_regions = huge_region;
+    }
+    else {
+        if(huge_region->prev)
+            huge_region->prev->next = huge_region->next;
+        else
+            mm_available_huge_regions = huge_region->next;
+        if(huge_region->next)
+            huge_region->next->prev = huge_region->prev;
+        huge_region->next = NULL;
+        huge_region->prev = NULL;
     }
+    huge_region->is_available = is_available;
 }
 
-static int
-free_blocks_comparison_function(
-        void *_block_meta_data1,
-        void *_block_meta_data2){
+/* Hands out one system page sized chunk of a huge page region.
+ * *is_zeroed tells whether the chunk was never used before*/
+static void *
+mm_huge_chunk_get(vm_bool_t *is_zeroed){
+
+    void *chunk = NULL;
+    mm_huge_region_t *huge_region = NULL;
+
+    pthread_mutex_lock(&mm_huge_region_lock);
+
+    huge_region = mm_available_huge_regions;
+    if(!huge_region){
+        huge_region = mm_huge_region_create();
+        if(!huge_region){
+            pthread_mutex_unlock(&mm_huge_region_lock);
+            return NULL;
+        }
+        mm_huge_region_count++;
+        mm_huge_region_set_available(huge_region, MM_TRUE);
+    }
+
+    if(huge_region->free_chunks){
+        chunk = huge_region->free_chunks;
+        huge_region->free_chunks = *(void **)chunk;
+        *is_zeroed = MM_FALSE;
+    }
+    else {
+        chunk = (char *)huge_region +
+            huge_region->next_unused_chunk++ * SYSTEM_PAGE_SIZE;
+        *is_zeroed = MM_TRUE;
+    }
+
+    huge_region->chunks_in_use++;
+    if(!huge_region->free_chunks &&
+            huge_region->next_unused_chunk == huge_region->chunk_count){
+        mm_huge_region_set_available(huge_region, MM_FALSE);
+    }
+
+    pthread_mutex_unlock(&mm_huge_region_lock);
+    return chunk;
+}
+
+/* Gives a chunk back to its region, the region is unmapped once none
+ * of its chunks is in use*/
+static void
+mm_huge_chunk_put(void *chunk){
+
+    mm_huge_region_t *huge_region = MM_HUGE_REGION_FROM_CHUNK(chunk);
+
+    pthread_mutex_lock(&mm_huge_region_lock);
+
+    if(--huge_region->chunks_in_use == 0){
+        mm_huge_region_set_available(huge_region, MM_FALSE);
+        munmap((void *)huge_region, MM_HUGE_PAGE_SIZE);
+        mm_huge_region_count--;
+        pthread_mutex_unlock(&mm_huge_region_lock);
+        return;
+    }
+
+    *(void **)chunk = huge_region->free_chunks;
+    huge_region->free_chunks = chunk;
+    mm_huge_region_set_available(huge_region, MM_TRUE);
+
+    pthread_mutex_unlock(&mm_huge_region_lock);
+}
+
+/* Requests a fresh VM data page of the node from the kernel, or from
+ * a huge page region in huge page mode. Huge page regions are shared
+ * by all nodes and not bound*/
+static vm_page_t *
+mm_get_new_data_vm_page(uint32_t page_units, uint32_t node,
+        vm_bool_t *is_zeroed){
+
+    vm_page_t *vm_page = NULL;
+
+    if(mm_huge_page_mode != MM_HUGE_PAGE_NONE && page_units == 1){
+        vm_page = (vm_page_t *)mm_huge_chunk_get(is_zeroed);
+        if(vm_page){
+            vm_page->is_huge_chunk = MM_TRUE;
+            vm_page->is_constructed = MM_FALSE;
+            vm_page->numa_node = node;
+            __atomic_add_fetch(&mm_numa_pages_mapped[node], page_units,
+                    __ATOMIC_RELAXED);
+            return vm_page;
+        }
+    }
+
+    vm_page = (vm_page_t *)mm_get_new_vm_page_from_kernel(page_units);
+    *is_zeroed = MM_TRUE;
+    if(!vm_page)
+        return NULL;
+
+    mm_numa_bind((void *)vm_page, page_units, node);
+    vm_page->is_huge_chunk = MM_FALSE;
+    vm_page->is_constructed = MM_FALSE;
+    vm_page->numa_node = node;
+    __atomic_add_fetch(&mm_numa_pages_mapped[node], page_units,
+            __ATOMIC_RELAXED);
+    return vm_page;
+}
+
+static void
+mm_return_data_vm_page(vm_page_t *vm_page){
+
+    mm_page_map_set((void *)vm_page, vm_page->page_units, MM_PAGE_KIND_NONE);
+    __atomic_sub_fetch(&mm_numa_pages_mapped[vm_page->numa_node],
+            vm_page->page_units, __ATOMIC_RELAXED);
+
+    if(vm_page->is_huge_chunk){
+        mm_huge_chunk_put((void *)vm_page);
+        return;
+    }
+    mm_return_vm_page_to_kernel((void *)vm_page, vm_page->page_units);
+}
+
+static void
+mm_union_free_blocks(block_meta_data_t *first,
+        block_meta_data_t *second){
+
+    assert(MM_BLOCK_IS(first, MM_BLOCK_FREE) &&
+            MM_BLOCK_IS(second, MM_BLOCK_FREE));
+
+    MM_BLOCK_SET_SIZE(first, MM_BLOCK_SIZE(first) +
+            sizeof(block_meta_data_t) + MM_BLOCK_SIZE(second));
+    /*The header of the second block now lies in the payload*/
+    MM_BLOCK_CLEAR(first, MM_BLOCK_ZEROED | MM_BLOCK_PURGED);
+
+    if(MM_BLOCK_IS(second, MM_BLOCK_LAST))
+        MM_BLOCK_SET(first, MM_BLOCK_LAST);
+    else
+        NEXT_META_BLOCK_BY_SIZE(first)->prev_offset = first->offset;
+}
+
+void
+mm_set_page_cache_limits(uint32_t family_max_pages,
+        uint32_t global_max_pages){
+
+    mm_family_page_cache_max = family_max_pages;
+    mm_global_page_cache_max = global_max_pages;
+}
+
+/* Unmaps cached pages of the global cache until at most 'target'
+ * of them are left*/
+static void
+mm_global_page_cache_trim(uint32_t target){
+
+    uint32_t node = 0;
+    vm_page_t *vm_page = NULL;
+
+    pthread_mutex_lock(&mm_global_page_cache_lock);
+    for( ; node < MM_MAX_NUMA_NODES; node++){
+        while(mm_global_page_cache_count > target &&
+                (vm_page = mm_global_page_cache[node])){
+            mm_global_page_cache[node] = vm_page->next;
+            mm_global_page_cache_count--;
+            mm_return_data_vm_page(vm_page);
+        }
+    }
+    pthread_mutex_unlock(&mm_global_page_cache_lock);
+}
+
+/* Runs the destructor of the page family on every object of a cached
+ * slab page about to leave the family. Caller holds the family_lock*/
+static void
+mm_vm_page_destruct(vm_page_family_t *vm_page_family, vm_page_t *vm_page){
+
+    uint32_t i = 0;
+    char *obj = (char *)vm_page + vm_page_family->slab_objects_offset;
+
+    if(!vm_page->is_constructed)
+        return;
+
+    if(vm_page_family->dtor){
+        for( ; i < vm_page_family->slab_object_count; i++){
+            vm_page_family->dtor(obj);
+            obj += vm_page_family->slab_object_size;
+        }
+    }
+    vm_page->is_constructed = MM_FALSE;
+}
+
+/* Moves cached pages of the page family out until at most 'target'
+ * of them are left. Single pages drop into the global cache of their
+ * node, spans go back to the kernel. Caller holds the family_lock*/
+static void
+mm_family_page_cache_trim(vm_page_family_t *vm_page_family,
+        uint32_t target){
+
+    uint32_t node = 0;
+    vm_page_t *vm_page = NULL;
+    mm_node_heap_t *node_heap = NULL;
+    vm_bool_t global_cache_overflow = MM_FALSE;
+
+    for( ; node < MM_MAX_NUMA_NODES; node++){
+
+        node_heap = &vm_page_family->node_heaps[node];
+
+        while(vm_page_family->cached_page_count > target &&
+                (vm_page = node_heap->cached_pages)){
+
+            node_heap->cached_pages = vm_page->next;
+            node_heap->cached_page_count--;
+            vm_page_family->cached_page_count--;
+            vm_page_family->pages_mapped -= vm_page->page_units;
+            mm_vm_page_destruct(vm_page_family, vm_page);
+
+            if(vm_page->page_units != 1){
+                vm_page_family->page_unmaps += vm_page->page_units;
+                mm_return_data_vm_page(vm_page);
+                continue;
+            }
+
+            pthread_mutex_lock(&mm_global_page_cache_lock);
+            vm_page->next = mm_global_page_cache[node];
+            mm_global_page_cache[node] = vm_page;
+            if(++mm_global_page_cache_count > mm_global_page_cache_max)
+                global_cache_overflow = MM_TRUE;
+            pthread_mutex_unlock(&mm_global_page_cache_lock);
+        }
+    }
+
+    /*Hysteresis : trim well below the watermark, not just under it*/
+    if(global_cache_overflow)
+        mm_global_page_cache_trim(mm_global_page_cache_max / 2);
+}
+
+/* Retains an empty, already unlinked VM page for reuse instead of
+ * unmapping it. Caller holds the family_lock*/
+static void
+mm_vm_page_release(vm_page_t *vm_page){
+
+    uint64_t start_ns = mm_latency_start();
+    vm_page_family_t *vm_page_family = vm_page->pg_family;
+    mm_node_heap_t *node_heap = MM_PAGE_NODE_HEAP(vm_page);
+
+    if(vm_page->is_direct){
+        vm_page_family->pages_mapped -= vm_page->page_units;
+        vm_page_family->page_unmaps += vm_page->page_units;
+        mm_return_data_vm_page(vm_page);
+    }
+    else {
+        vm_page->prev = NULL;
+        vm_page->next = node_heap->cached_pages;
+        node_heap->cached_pages = vm_page;
+        node_heap->cached_page_count++;
+
+        if(++vm_page_family->cached_page_count > mm_family_page_cache_max){
+            mm_family_page_cache_trim(vm_page_family,
+                    mm_family_page_cache_max / 2);
+        }
+    }
+
+    mm_latency_record(vm_page_family, MM_LATENCY_PAGE_RELEASE, start_ns);
+}
+
+/* Takes a cached VM page of 'page_units' pages of the node from the
+ * family cache, or from the global cache for single pages. Caller
+ * holds the family_lock*/
+static vm_page_t *
+mm_vm_page_cache_get(vm_page_family_t *vm_page_family,
+        uint32_t page_units, uint32_t node){
+
+    vm_page_t *vm_page = NULL;
+    mm_node_heap_t *node_heap = &vm_page_family->node_heaps[node];
+    vm_page_t **link = &node_heap->cached_pages;
+
+    for( ; *link; link = &(*link)->next){
+
+        if((*link)->page_units == page_units){
+            vm_page = *link;
+            *link = vm_page->next;
+            node_heap->cached_page_count--;
+            vm_page_family->cached_page_count--;
+            /*Held all along, allocate_vm_page() counts it in again*/
+            vm_page_family->pages_mapped -= page_units;
+            return vm_page;
+        }
+    }
+
+    if(page_units != 1)
+        return NULL;
+
+    pthread_mutex_lock(&mm_global_page_cache_lock);
+    vm_page = mm_global_page_cache[node];
+    if(vm_page){
+        mm_global_page_cache[node] = vm_page->next;
+        mm_global_page_cache_count--;
+        mm_global_page_cache_hits++;
+    }
+    pthread_mutex_unlock(&mm_global_page_cache_lock);
+    return vm_page;
+}
+
+vm_page_t *
+allocate_vm_page(vm_page_family_t *vm_page_family, uint32_t page_units,
+        uint32_t node){
+
+    uint64_t start_ns = mm_latency_start();
+    vm_bool_t is_zeroed = MM_FALSE;
+    vm_page_t *vm_page = mm_vm_page_cache_get(vm_page_family,
+            page_units, node);
+
+    if(vm_page){
+        vm_page_family->page_cache_hits++;
+    }
+    else {
+        vm_page_family->page_cache_misses++;
+        vm_page = mm_get_new_data_vm_page(page_units, node, &is_zeroed);
+        if(vm_page && !vm_page->is_huge_chunk)
+            vm_page_family->page_maps += page_units;
+    }
+
+    if(!vm_page)
+        return NULL;
+
+    vm_page->page_units = page_units;
+    vm_page->pg_family = vm_page_family;
+    vm_page_family->pages_mapped += page_units;
+
+    if(!mm_page_map_set((void *)vm_page, page_units, MM_PAGE_KIND_BLOCKS)){
+        vm_page->is_direct = MM_FALSE;
+        mm_vm_page_release(vm_page);
+        return NULL;
+    }
+   
+    /*Initialize lower most Meta block of the VM page*/
+    MARK_VM_PAGE_EMPTY(vm_page);
+
+    vm_page->is_direct = MM_FALSE;
+    vm_page->is_slab = MM_FALSE;
+    vm_page->bytes_in_use = 0;
+    MM_BLOCK_SET_SIZE(&vm_page->block_meta_data,
+            mm_max_page_allocatable_memory(page_units));
+    if(is_zeroed)
+        MM_BLOCK_SET(&vm_page->block_meta_data, MM_BLOCK_ZEROED);
+    vm_page->next = NULL;
+    vm_page->prev = NULL;
+
+    /* Insert new VM page to the head of the linked 
+     * list, it may be the first VM data page of the
+     * page family*/
+    vm_page->next = vm_page_family->first_page;
+    if(vm_page_family->first_page)
+        vm_page_family->first_page->prev = vm_page;
+    vm_page_family->first_page = vm_page;
+
+    mm_latency_record(vm_page_family, MM_LATENCY_PAGE_ACQUIRE, start_ns);
+    return vm_page;
+}
+
+void
+mm_vm_page_delete_and_free(
+        vm_page_t *vm_page){
+
+    vm_page_family_t *vm_page_family =
+        vm_page->pg_family;
+
+    /*If the page being deleted is the head of the linked 
+     * list*/
+    if(vm_page_family->first_page == vm_page){
+        vm_page_family->first_page = vm_page->next;
+        if(vm_page->next)
+            vm_page->next->prev = NULL;
+        vm_page->next = NULL;
+        vm_page->prev = NULL;
+        mm_vm_page_release(vm_page);
+        return;
+    }
+
+    /*If we are deleting the page from middle or end of 
+     * linked list*/
+    if(vm_page->next)
+        vm_page->next->prev = vm_page->prev;
+    vm_page->prev->next = vm_page->next;
+    mm_vm_page_release(vm_page);
+}
+
+void
+mm_print_vm_page_details(vm_page_t *vm_page){
+
+    printf("\t\t next = %p, prev = %p, units = %u, node = %u%s\n",
+            vm_page->next, vm_page->prev, vm_page->page_units,
+            vm_page->numa_node, vm_page->is_direct ? " (direct)" : "");
+    printf("\t\t page family = %s\n", vm_page->pg_family->struct_name);
+
+    if(vm_page->is_slab){
+        printf("\t\t\tslab objects = %-6u  free = %u\n",
+                vm_page->pg_family->slab_object_count,
+                ((mm_slab_page_t *)vm_page)->free_count);
+        return;
+    }
+
+    uint32_t j = 0;
+    block_meta_data_t *curr;
+    ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page, curr){
+
+        printf("\t\t\t%-14p Block %-3u %s  block_size = %-6u  "
+                "offset = %-6u  prev = %-14p  next = %p\n",
+                curr,
+                j++, MM_BLOCK_IS(curr, MM_BLOCK_FREE) ? "F R E E D" : "ALLOCATED",
+                MM_BLOCK_SIZE(curr), curr->offset * MM_BLOCK_ALIGN,
+                PREV_META_BLOCK(curr),
+                NEXT_META_BLOCK(curr));
+    } ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page, curr);
+}
+
+
+
+
+static void
+mm_init_node_heaps(vm_page_family_t *vm_page_family){
+
+    uint32_t i = 0;
+    uint32_t node = 0;
+    mm_node_heap_t *node_heap = NULL;
+
+    for( ; node < MM_MAX_NUMA_NODES; node++){
+
+        node_heap = &vm_page_family->node_heaps[node];
+        node_heap->cached_pages = NULL;
+        node_heap->cached_page_count = 0;
+        node_heap->partial_slab_pages = NULL;
+        node_heap->local_allocs = 0;
+        node_heap->remote_allocs = 0;
+        node_heap->free_block_bin_bitmap = 0;
+        for(i = 0; i < MM_FREE_BLOCK_BINS; i++){
+            init_glthread(&node_heap->free_block_bins[i]);
+        }
+    }
+}
+
+static inline uint32_t
+mm_family_name_hash(char *struct_name){
+
+    /*FNV-1a*/
+    uint32_t i = 0;
+    uint32_t hash = 2166136261u;
+
+    for( ; i < MM_MAX_STRUCT_NAME && struct_name[i]; i++){
+        hash ^= (unsigned char)struct_name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*Caller holds mm_registry_lock*/
+static vm_page_family_t *
+mm_lookup_page_family_locked(char *struct_name){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    if(!mm_family_hash_buckets)
+        return NULL;
+
+    vm_page_family_curr = mm_family_hash_buckets[
+        mm_family_name_hash(struct_name) & (mm_family_hash_bucket_count - 1)];
+
+    for( ; vm_page_family_curr;
+            vm_page_family_curr = vm_page_family_curr->hash_next){
+
+        if(strncmp(vm_page_family_curr->struct_name,
+                    struct_name,
+                    MM_MAX_STRUCT_NAME) == 0){
+
+            return vm_page_family_curr;
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t
+mm_family_hash_units(uint32_t bucket_count){
+
+    return (bucket_count * sizeof(vm_page_family_t *) + SYSTEM_PAGE_SIZE - 1) /
+        SYSTEM_PAGE_SIZE;
+}
+
+/* Doubles the hash index (or creates it) once the registry holds as
+ * many page families as there are buckets*/
+static void
+mm_family_hash_grow(){
+
+    uint32_t i = 0;
+    uint32_t bucket_index = 0;
+    vm_page_family_t *vm_page_family_curr = NULL;
+    vm_page_family_t *vm_page_family_next = NULL;
+    uint32_t new_bucket_count = mm_family_hash_bucket_count ?
+        mm_family_hash_bucket_count * 2 : MM_FAMILY_HASH_INITIAL_BUCKETS;
+
+    vm_page_family_t **new_buckets = (vm_page_family_t **)
+        mm_get_new_vm_page_from_kernel(mm_family_hash_units(new_bucket_count));
+
+    if(!new_buckets)
+        return;
+
+    for( ; i < mm_family_hash_bucket_count; i++){
+
+        for(vm_page_family_curr = mm_family_hash_buckets[i];
+                vm_page_family_curr;
+                vm_page_family_curr = vm_page_family_next){
+
+            vm_page_family_next = vm_page_family_curr->hash_next;
+            bucket_index = mm_family_name_hash(vm_page_family_curr->struct_name) &
+                (new_bucket_count - 1);
+            vm_page_family_curr->hash_next = new_buckets[bucket_index];
+            new_buckets[bucket_index] = vm_page_family_curr;
+        }
+    }
+
+    if(mm_family_hash_buckets){
+        mm_return_vm_page_to_kernel(mm_family_hash_buckets,
+                mm_family_hash_units(mm_family_hash_bucket_count));
+    }
+    mm_family_hash_buckets = new_buckets;
+    mm_family_hash_bucket_count = new_bucket_count;
+}
+
+/*Caller holds mm_registry_lock for writing*/
+static vm_page_family_t *
+mm_get_free_family_slot(){
+
+    vm_page_family_t *vm_page_family = mm_free_family_slots;
+    vm_page_for_families_t *new_vm_page_for_families = NULL;
+
+    if(vm_page_family){
+        mm_free_family_slots = vm_page_family->hash_next;
+        return vm_page_family;
+    }
+
+    if(!first_vm_page_for_families ||
+            first_vm_page_for_families->count == MAX_FAMILIES_PER_VM_PAGE){
+
+        new_vm_page_for_families = (vm_page_for_families_t *)
+            mm_get_new_vm_page_from_kernel(MM_REGISTRY_PAGE_UNITS);
+        if(!new_vm_page_for_families)
+            return NULL;
+        new_vm_page_for_families->next = first_vm_page_for_families;
+        new_vm_page_for_families->count = 0;
+        first_vm_page_for_families = new_vm_page_for_families;
+    }
+
+    vm_page_family = &first_vm_page_for_families->vm_page_family[
+        first_vm_page_for_families->count++];
+    vm_page_family->family_id = mm_next_family_id++;
+    vm_page_family->generation = 0;
+    return vm_page_family;
+}
+
+/* Lays out a slab page for objects of struct_size bytes : header,
+ * bitmap, then as many objects as still fit. Returns MM_FALSE if too
+ * few objects fit for slab mode to pay off*/
+static vm_bool_t
+mm_slab_geometry(uint32_t object_size, uint32_t align,
+        uint32_t *object_count, uint32_t *objects_offset){
+
+    uint32_t n = (SYSTEM_PAGE_SIZE - sizeof(mm_slab_page_t)) / object_size;
+    uint32_t offset = 0;
+
+    for( ; n >= MM_SLAB_MIN_OBJECTS_PER_PAGE; n--){
+
+        offset = (sizeof(mm_slab_page_t) +
+                ((n + 63) / 64) * sizeof(uint64_t) + align - 1) & ~(align - 1);
+        if(offset + (uint64_t)n * object_size <= SYSTEM_PAGE_SIZE){
+            *object_count = n;
+            *objects_offset = offset;
+            return MM_TRUE;
+        }
+    }
+    return MM_FALSE;
+}
+
+static inline vm_bool_t
+mm_align_is_valid(uint32_t align){
+
+    return align && !(align & (align - 1)) && align <= SYSTEM_PAGE_SIZE;
+}
+
+mm_family_handle_t
+mm_instantiate_new_page_family(
+    char *struct_name,
+    uint32_t struct_size){
+
+    return mm_instantiate_new_page_family_ex(struct_name, struct_size, NULL);
+}
+
+mm_family_handle_t
+mm_instantiate_new_page_family_ex(
+    char *struct_name,
+    uint32_t struct_size,
+    mm_family_attr_t *attr){
+
+    uint32_t align = 0;
+    uint32_t bucket_index = 0;
+    uint32_t slab_object_count = 0;
+    uint32_t slab_objects_offset = 0;
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    if(!struct_size){
+        
+        printf("Error : %s() Structure %s has zero size\n",
+            __FUNCTION__, struct_name);
+        return NULL;
+    }
+
+    if(attr && attr->align && !mm_align_is_valid(attr->align)){
+
+        printf("Error : %s() Alignment %u of structure %s is not a power "
+                "of 2 up to the page size\n", __FUNCTION__, attr->align,
+                struct_name);
+        return NULL;
+    }
+
+    if(attr && attr->placement >= MM_PLACEMENT_POLICIES){
+
+        printf("Error : %s() Unknown placement policy %u of structure %s\n",
+                __FUNCTION__, attr->placement, struct_name);
+        return NULL;
+    }
+
+    if(attr && ((attr->flags & MM_FAMILY_SLAB) || attr->ctor) &&
+            (attr->flags & MM_FAMILY_ARENA)){
+
+        printf("Error : %s() Structure %s can not be both slab and arena\n",
+                __FUNCTION__, struct_name);
+        return NULL;
+    }
+
+    if(attr && attr->dtor && !attr->ctor){
+
+        printf("Error : %s() Destructor of structure %s needs a constructor\n",
+                __FUNCTION__, struct_name);
+        return NULL;
+    }
+
+    /*Constructed objects are cached in slab pages only*/
+    if(attr && attr->ctor){
+
+        align = attr->align > MM_BLOCK_ALIGN ? attr->align : MM_BLOCK_ALIGN;
+        if(!mm_slab_geometry((struct_size + align - 1) & ~(align - 1), align,
+                    &slab_object_count, &slab_objects_offset)){
+
+            printf("Error : %s() Structure %s is too big to be constructed "
+                    "in slab pages\n", __FUNCTION__, struct_name);
+            return NULL;
+        }
+    }
+
+    pthread_rwlock_wrlock(&mm_registry_lock);
+
+	vm_page_family_curr = mm_lookup_page_family_locked(struct_name);
+
+	if(vm_page_family_curr) {
+		assert(0);
+	}
+
+    if(mm_registered_family_count >= mm_family_hash_bucket_count)
+        mm_family_hash_grow();
+
+    vm_page_family_curr = mm_get_free_family_slot();
+
+    if(!vm_page_family_curr || !mm_family_hash_buckets){
+        pthread_rwlock_unlock(&mm_registry_lock);
+        return NULL;
+    }
+
+    strncpy(vm_page_family_curr->struct_name, struct_name,
+            MM_MAX_STRUCT_NAME);
+    vm_page_family_curr->struct_size = struct_size;
+    vm_page_family_curr->first_page = NULL;
+    vm_page_family_curr->cached_page_count = 0;
+    vm_page_family_curr->page_cache_hits = 0;
+    vm_page_family_curr->page_cache_misses = 0;
+    vm_page_family_curr->page_maps = 0;
+    vm_page_family_curr->blocks_in_use = 0;
+    vm_page_family_curr->blocks_free = 0;
+    vm_page_family_curr->bytes_in_use = 0;
+    vm_page_family_curr->pages_mapped = 0;
+    vm_page_family_curr->page_unmaps = 0;
+    vm_page_family_curr->bytes_purged = 0;
+    vm_page_family_curr->purges = 0;
+    vm_page_family_curr->allocs = 0;
+    vm_page_family_curr->frees = 0;
+    vm_page_family_curr->latency_histograms = NULL;
+    vm_page_family_curr->flags = attr ? attr->flags : 0;
+    vm_page_family_curr->ctor = attr ? attr->ctor : NULL;
+    vm_page_family_curr->dtor = attr ? attr->dtor : NULL;
+    if(vm_page_family_curr->ctor)
+        vm_page_family_curr->flags |= MM_FAMILY_SLAB;
+    vm_page_family_curr->align = MM_BLOCK_ALIGN;
+    if(attr && attr->align > MM_BLOCK_ALIGN)
+        vm_page_family_curr->align = attr->align;
+    vm_page_family_curr->placement = attr ? attr->placement :
+        MM_PLACEMENT_BEST_FIT;
+    vm_page_family_curr->arena_page = NULL;
+    vm_page_family_curr->arena_top = NULL;
+    vm_page_family_curr->slab_object_size =
+        (struct_size + vm_page_family_curr->align - 1) &
+        ~(vm_page_family_curr->align - 1);
+    if((vm_page_family_curr->flags & MM_FAMILY_SLAB) &&
+            !mm_slab_geometry(vm_page_family_curr->slab_object_size,
+                vm_page_family_curr->align,
+                &vm_page_family_curr->slab_object_count,
+                &vm_page_family_curr->slab_objects_offset)){
+        vm_page_family_curr->flags &= ~MM_FAMILY_SLAB;
+    }
+    vm_page_family_curr->slab_size_reciprocal =
+        (uint32_t)(((1ULL << 32) + vm_page_family_curr->slab_object_size - 1) /
+                vm_page_family_curr->slab_object_size);
+    mm_init_node_heaps(vm_page_family_curr);
+    pthread_mutex_init(&vm_page_family_curr->family_lock, NULL);
+    __atomic_store_n(&vm_page_family_curr->registration,
+            ++mm_next_registration, __ATOMIC_RELAXED);
+
+    bucket_index = mm_family_name_hash(vm_page_family_curr->struct_name) &
+        (mm_family_hash_bucket_count - 1);
+    vm_page_family_curr->hash_next = mm_family_hash_buckets[bucket_index];
+    mm_family_hash_buckets[bucket_index] = vm_page_family_curr;
+    mm_registered_family_count++;
+    mm_trace(MM_TRACE_REGISTER, vm_page_family_curr->flags,
+            vm_page_family_curr, struct_size,
+            (void *)(uintptr_t)vm_page_family_curr->align);
+
+    pthread_rwlock_unlock(&mm_registry_lock);
+    return vm_page_family_curr;
+}
+
+static inline void
+mm_tcache_bin_merge_stats(mm_tcache_bin_t *tcache_bin);
+
+/* Drops every VM page of the page family into the page caches, or
+ * unmaps it, without visiting its blocks, and empties the free block
+ * bins and partial slab lists. Blocks of the family sitting in thread
+ * caches are forgotten on their next use. Caller holds the
+ * family_lock*/
+static void
+mm_family_release_pages(vm_page_family_t *vm_page_family){
+
+    uint32_t i = 0;
+    uint32_t node = 0;
+    vm_page_t *vm_page = NULL;
+    mm_node_heap_t *node_heap = NULL;
+    mm_tcache_bin_t *tcache_bin = NULL;
+
+    /*Only the hit counts of the caller's cached blocks survive*/
+    if(mm_tcache.initialized &&
+            vm_page_family->family_id < MM_TCACHE_MAX_FAMILIES){
+        tcache_bin = &mm_tcache.bins[vm_page_family->family_id];
+        if(tcache_bin->vm_page_family == vm_page_family &&
+                tcache_bin->generation == vm_page_family->generation){
+            mm_tcache_bin_merge_stats(tcache_bin);
+        }
+    }
+    __atomic_store_n(&vm_page_family->generation,
+            vm_page_family->generation + 1, __ATOMIC_RELAXED);
+
+    /* Objects of ctor families are destructed as they are, live ones
+     * included, so that reused pages are constructed afresh*/
+    ITERATE_VM_PAGE_BEGIN(vm_page_family, vm_page){
+
+        vm_page->next = NULL;
+        vm_page->prev = NULL;
+        mm_vm_page_destruct(vm_page_family, vm_page);
+        mm_vm_page_release(vm_page);
+    } ITERATE_VM_PAGE_END(vm_page_family, vm_page);
+    vm_page_family->first_page = NULL;
+    vm_page_family->arena_page = NULL;
+    vm_page_family->arena_top = NULL;
+
+    for( ; node < MM_MAX_NUMA_NODES; node++){
+
+        node_heap = &vm_page_family->node_heaps[node];
+        node_heap->partial_slab_pages = NULL;
+        node_heap->free_block_bin_bitmap = 0;
+        for(i = 0; i < MM_FREE_BLOCK_BINS; i++){
+            init_glthread(&node_heap->free_block_bins[i]);
+        }
+    }
+
+    vm_page_family->blocks_in_use = 0;
+    vm_page_family->blocks_free = 0;
+    vm_page_family->bytes_in_use = 0;
+    vm_page_family->bytes_purged = 0;
+}
+
+void
+mm_family_release_all(mm_family_handle_t handle){
+
+    vm_page_family_t *vm_page_family = handle;
+
+    if(!vm_page_family){
+        printf("Error : Invalid page family handle\n");
+        return;
+    }
+
+    mm_trace(MM_TRACE_RELEASE_ALL, 0, vm_page_family, 0, NULL);
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    mm_family_release_pages(vm_page_family);
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+}
+
+void
+mm_arena_reset(mm_family_handle_t handle){
+
+    vm_page_t *vm_page = NULL;
+    vm_page_t *last_vm_page = NULL;
+    vm_page_family_t *vm_page_family = handle;
+
+    if(!vm_page_family || !(vm_page_family->flags & MM_FAMILY_ARENA)){
+        printf("Error : %s() needs the handle of an arena page family\n",
+                __FUNCTION__);
+        return;
+    }
+
+    mm_trace(MM_TRACE_ARENA_RESET, 0, vm_page_family, 0, NULL);
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+
+    ITERATE_VM_PAGE_BEGIN(vm_page_family, vm_page){
+
+        if(vm_page->is_direct){
+            mm_vm_page_delete_and_free(vm_page);
+            continue;
+        }
+        MARK_VM_PAGE_EMPTY(vm_page);
+        MM_BLOCK_SET_SIZE(&vm_page->block_meta_data,
+                mm_max_page_allocatable_memory(vm_page->page_units));
+        vm_page->bytes_in_use = 0;
+        last_vm_page = vm_page;
+    } ITERATE_VM_PAGE_END(vm_page_family, vm_page);
+
+    /*Bumping starts over from the oldest page, towards the head*/
+    vm_page_family->arena_page = last_vm_page;
+    vm_page_family->arena_top = last_vm_page ?
+        &last_vm_page->block_meta_data : NULL;
+    vm_page_family->blocks_in_use = 0;
+    vm_page_family->bytes_in_use = 0;
+
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+}
+
+void
+mm_unregister_page_family(char *struct_name){
+
+    vm_page_family_t **link = NULL;
+    vm_page_family_t *vm_page_family = NULL;
+
+    pthread_rwlock_wrlock(&mm_registry_lock);
+
+    vm_page_family = mm_lookup_page_family_locked(struct_name);
+
+    if(!vm_page_family){
+        pthread_rwlock_unlock(&mm_registry_lock);
+        printf("Error : Structure %s not registered with Memory Manager\n",
+                struct_name);
+        return;
+    }
+
+    for(link = &mm_family_hash_buckets[mm_family_name_hash(struct_name) &
+            (mm_family_hash_bucket_count - 1)];
+            *link != vm_page_family;
+            link = &(*link)->hash_next);
+    *link = vm_page_family->hash_next;
+    mm_trace(MM_TRACE_UNREGISTER, 0, vm_page_family, 0, NULL);
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+
+    /*Blocks still sitting in thread caches are dropped*/
+    mm_family_release_pages(vm_page_family);
+    mm_family_page_cache_trim(vm_page_family, 0);
+    mm_init_node_heaps(vm_page_family);
+    vm_page_family->struct_size = 0;
+    if(vm_page_family->latency_histograms){
+        mm_return_vm_page_to_kernel(vm_page_family->latency_histograms,
+                (sizeof(mm_latency_histograms_t) + SYSTEM_PAGE_SIZE - 1) /
+                SYSTEM_PAGE_SIZE);
+        vm_page_family->latency_histograms = NULL;
+    }
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    pthread_mutex_destroy(&vm_page_family->family_lock);
+    __atomic_store_n(&vm_page_family->registration, 0, __ATOMIC_RELAXED);
+
+    vm_page_family->hash_next = mm_free_family_slots;
+    mm_free_family_slots = vm_page_family;
+    mm_registered_family_count--;
+
+    pthread_rwlock_unlock(&mm_registry_lock);
+}
+
+void
+mm_print_registered_page_families(){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    pthread_rwlock_rdlock(&mm_registry_lock);
+
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families,
+            vm_page_family_curr){
+
+        printf("Page Family : %s, Size = %u\n",
+                vm_page_family_curr->struct_name,
+                vm_page_family_curr->struct_size);
+
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families,
+            vm_page_family_curr);
+
+    pthread_rwlock_unlock(&mm_registry_lock);
+}
+
+/* Bins of first fit families are treaps keyed by block address. The
+ * priority of a node is a hash of its address. The free list glue holds
+ * the children, MM_FREE_TREE_NIL standing for none, so that the glue of
+ * a block in a bin is never empty. The right of the bin head is the
+ * root, NULL for an empty bin, and its left the lowest node, so that
+ * the lowest blocks of the bins are compared without walking them.
+ * Every node also keeps the biggest block size of its subtree, right
+ * past the glue, so that the first fit in a bin is found in O(log n)*/
+#define MM_FREE_TREE_NIL    ((glthread_t *)1)
+
+#define MM_FREE_TREE_MAX_SIZE(node)     (*(uint32_t *)((node) + 1))
+
+static inline uint32_t
+mm_free_tree_priority(glthread_t *node){
+
+    uint64_t hash = (uintptr_t)node;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+
+static inline uint32_t
+mm_free_tree_max_size(glthread_t *node){
+
+    return node == MM_FREE_TREE_NIL ? 0 : MM_FREE_TREE_MAX_SIZE(node);
+}
+
+static inline void
+mm_free_tree_update(glthread_t *node){
+
+    uint32_t max_size = MM_BLOCK_SIZE(glthread_to_block_meta_data(node));
+
+    if(mm_free_tree_max_size(node->left) > max_size)
+        max_size = mm_free_tree_max_size(node->left);
+    if(mm_free_tree_max_size(node->right) > max_size)
+        max_size = mm_free_tree_max_size(node->right);
+    MM_FREE_TREE_MAX_SIZE(node) = max_size;
+}
+
+/*Splits the subtree into the nodes below and above 'key'*/
+static void
+mm_free_tree_split(glthread_t *curr, glthread_t *key,
+        glthread_t **left, glthread_t **right){
+
+    if(curr == MM_FREE_TREE_NIL){
+        *left = MM_FREE_TREE_NIL;
+        *right = MM_FREE_TREE_NIL;
+        return;
+    }
+    if(curr < key){
+        *left = curr;
+        mm_free_tree_split(curr->right, key, &curr->right, right);
+    }
+    else {
+        *right = curr;
+        mm_free_tree_split(curr->left, key, left, &curr->left);
+    }
+    mm_free_tree_update(curr);
+}
+
+/*Joins two subtrees, every node of 'left' being below those of 'right'*/
+static glthread_t *
+mm_free_tree_merge(glthread_t *left, glthread_t *right){
+
+    if(left == MM_FREE_TREE_NIL)
+        return right;
+    if(right == MM_FREE_TREE_NIL)
+        return left;
+
+    if(mm_free_tree_priority(left) > mm_free_tree_priority(right)){
+        left->right = mm_free_tree_merge(left->right, right);
+        mm_free_tree_update(left);
+        return left;
+    }
+    right->left = mm_free_tree_merge(left, right->left);
+    mm_free_tree_update(right);
+    return right;
+}
+
+static glthread_t *
+mm_free_tree_insert_at(glthread_t *curr, glthread_t *node){
+
+    /*The subtree the node takes the place of is split around it*/
+    if(curr == MM_FREE_TREE_NIL ||
+            mm_free_tree_priority(curr) < mm_free_tree_priority(node)){
+        mm_free_tree_split(curr, node, &node->left, &node->right);
+        mm_free_tree_update(node);
+        return node;
+    }
+
+    if(node < curr)
+        curr->left = mm_free_tree_insert_at(curr->left, node);
+    else
+        curr->right = mm_free_tree_insert_at(curr->right, node);
+    mm_free_tree_update(curr);
+    return curr;
+}
+
+static glthread_t *
+mm_free_tree_remove_at(glthread_t *curr, glthread_t *node){
+
+    if(curr == node)
+        return mm_free_tree_merge(node->left, node->right);
+
+    if(node < curr)
+        curr->left = mm_free_tree_remove_at(curr->left, node);
+    else
+        curr->right = mm_free_tree_remove_at(curr->right, node);
+    mm_free_tree_update(curr);
+    return curr;
+}
+
+static void
+mm_free_tree_insert(glthread_t *bin, glthread_t *node){
+
+    bin->right = mm_free_tree_insert_at(
+            bin->right ? bin->right : MM_FREE_TREE_NIL, node);
+
+    if(!bin->left || node < bin->left)
+        bin->left = node;
+}
+
+static void
+mm_free_tree_remove(glthread_t *bin, glthread_t *node){
+
+    bin->right = mm_free_tree_remove_at(bin->right, node);
+
+    if(bin->right == MM_FREE_TREE_NIL){
+        bin->right = NULL;
+        bin->left = NULL;
+    }
+    else if(bin->left == node){
+        for(bin->left = bin->right; bin->left->left != MM_FREE_TREE_NIL;
+                bin->left = bin->left->left);
+    }
+    init_glthread(node);
+}
+
+/*Lowest block of the subtree holding req_size bytes, in O(log n)*/
+static block_meta_data_t *
+mm_free_tree_first_fit(glthread_t *curr, uint32_t req_size){
+
+    while(curr != MM_FREE_TREE_NIL &&
+            MM_FREE_TREE_MAX_SIZE(curr) >= req_size){
+
+        if(mm_free_tree_max_size(curr->left) >= req_size){
+            curr = curr->left;
+            continue;
+        }
+        if(MM_BLOCK_SIZE(glthread_to_block_meta_data(curr)) >= req_size)
+            return glthread_to_block_meta_data(curr);
+        curr = curr->right;
+    }
+    return NULL;
+}
+
+/* Whole system pages of a free block holding neither its header and
+ * free block meta data nor the header of the next block. Returns their size
+ * in bytes, 0 if there are none, and their start in *start*/
+static inline uint32_t
+mm_block_purge_range(block_meta_data_t *free_block, char **start){
+
+    uintptr_t first = (uintptr_t)(free_block + 1) + MM_FREE_BLOCK_META_SIZE;
+    uintptr_t end = (uintptr_t)(free_block + 1) + MM_BLOCK_SIZE(free_block);
+
+    first = (first + SYSTEM_PAGE_SIZE - 1) & ~(SYSTEM_PAGE_SIZE - 1);
+    end &= ~(SYSTEM_PAGE_SIZE - 1);
+    if(start)
+        *start = (char *)first;
+    return end > first ? (uint32_t)(end - first) : 0;
+}
+
+/* Gives the whole system pages of a free block, out of any bin, back
+ * to the kernel once they reach the purge threshold. They stay mapped
+ * and fault in as fresh pages when the block is reused. Only blocks of
+ * multi page spans are big enough*/
+static void
+mm_free_block_purge(vm_page_family_t *vm_page_family,
+        block_meta_data_t *free_block){
+
+    char *start = NULL;
+    uint32_t purge_size = 0;
+
+    if(!mm_purge_threshold || MM_BLOCK_IS(free_block, MM_BLOCK_PURGED))
+        return;
+
+    purge_size = mm_block_purge_range(free_block, &start);
+    if(!purge_size || purge_size < mm_purge_threshold)
+        return;
+
+    if(madvise(start, purge_size, mm_purge_advice) < 0){
+        /*MADV_FREE needs Linux 4.5 and up*/
+        if(errno != EINVAL || mm_purge_advice == MADV_DONTNEED ||
+                madvise(start, purge_size, MADV_DONTNEED) < 0){
+            return;
+        }
+        mm_purge_advice = MADV_DONTNEED;
+    }
+    MM_BLOCK_SET(free_block, MM_BLOCK_PURGED);
+    vm_page_family->purges++;
+}
+
+static void
+mm_add_free_block_meta_data_to_free_block_list(
+        vm_page_family_t *vm_page_family,
+        block_meta_data_t *free_block){
+
+    assert(MM_BLOCK_IS(free_block, MM_BLOCK_FREE));
+
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(free_block);
+    mm_node_heap_t *node_heap = MM_PAGE_NODE_HEAP(vm_page);
+    uint32_t bin_index = mm_free_block_bin_index(
+            vm_page_family, MM_BLOCK_SIZE(free_block));
+
+    init_glthread(MM_FREE_BLOCK_GLUE(free_block));
+
+    if(vm_page_family->placement == MM_PLACEMENT_FIRST_FIT){
+        mm_free_tree_insert(&node_heap->free_block_bins[bin_index],
+                MM_FREE_BLOCK_GLUE(free_block));
+    }
+    else {
+        glthread_add_next(&node_heap->free_block_bins[bin_index],
+                MM_FREE_BLOCK_GLUE(free_block));
+    }
+    vm_page_family->blocks_free++;
+    node_heap->free_block_bin_bitmap |= (1ULL << bin_index);
+
+    if(MM_BLOCK_IS(free_block, MM_BLOCK_PURGED))
+        vm_page_family->bytes_purged += mm_block_purge_range(free_block, NULL);
+}
+
+/* The block must still have the block_size it was inserted with,
+ * since that is what identifies its bin*/
+static void
+mm_remove_free_block_meta_data_from_free_block_list(
+        vm_page_family_t *vm_page_family,
+        block_meta_data_t *free_block){
+
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(free_block);
+    mm_node_heap_t *node_heap = MM_PAGE_NODE_HEAP(vm_page);
+    uint32_t bin_index = mm_free_block_bin_index(
+            vm_page_family, MM_BLOCK_SIZE(free_block));
+
+    if(vm_page_family->placement == MM_PLACEMENT_FIRST_FIT){
+        mm_free_tree_remove(&node_heap->free_block_bins[bin_index],
+                MM_FREE_BLOCK_GLUE(free_block));
+    }
+    else {
+        remove_glthread(MM_FREE_BLOCK_GLUE(free_block));
+    }
+    vm_page_family->blocks_free--;
+
+    if(MM_BLOCK_IS(free_block, MM_BLOCK_PURGED))
+        vm_page_family->bytes_purged -= mm_block_purge_range(free_block, NULL);
+
+    if(IS_GLTHREAD_LIST_EMPTY(&node_heap->free_block_bins[bin_index])){
+        node_heap->free_block_bin_bitmap &= ~(1ULL << bin_index);
+    }
+}
+
+/* Returns the lowest addressed free block of the node which can
+ * satisfy the request. Every block of the bins above the request fits,
+ * so only their lowest blocks need to be compared, plus the first fit
+ * of a log spaced bin shared with the request*/
+static block_meta_data_t *
+mm_get_first_fit_free_block_page_family(
+        mm_node_heap_t *node_heap,
+        uint32_t bin_index,
+        uint32_t req_size){
+
+    glthread_t *lowest = NULL;
+    block_meta_data_t *first_fit_block_meta_data = NULL;
+    uint64_t bitmap = node_heap->free_block_bin_bitmap &
+        (~0ULL << bin_index);
+
+    if(bin_index >= MM_FREE_BLOCK_EXACT_BINS && (bitmap & 1ULL << bin_index)){
+        first_fit_block_meta_data = mm_free_tree_first_fit(
+                node_heap->free_block_bins[bin_index].right, req_size);
+        bitmap &= bitmap - 1;
+    }
+
+    for( ; bitmap; bitmap &= bitmap - 1){
+
+        lowest = node_heap->free_block_bins[__builtin_ctzll(bitmap)].left;
+        if(!first_fit_block_meta_data ||
+                glthread_to_block_meta_data(lowest) < first_fit_block_meta_data){
+            first_fit_block_meta_data = glthread_to_block_meta_data(lowest);
+        }
+    }
+    return first_fit_block_meta_data;
+}
+
+/* Returns the free block of the node which can satisfy the request and
+ * whose VM page has the most bytes in use, among the first
+ * MM_PLACEMENT_SCAN_LIMIT fitting blocks from the smallest bin up. The
+ * scan goes on into the next bins when a bin runs out of blocks*/
+static block_meta_data_t *
+mm_get_fullest_page_free_block_page_family(
+        mm_node_heap_t *node_heap,
+        uint32_t bin_index,
+        uint32_t req_size){
+
+    glthread_t *curr = NULL;
+    vm_page_t *vm_page = NULL;
+    uint32_t scanned = 0;
+    uint32_t fullest_bytes_in_use = 0;
+    block_meta_data_t *block_meta_data = NULL;
+    block_meta_data_t *fullest_block_meta_data = NULL;
+    uint64_t bitmap = node_heap->free_block_bin_bitmap &
+        (~0ULL << bin_index);
+
+    for( ; bitmap; bitmap &= bitmap - 1){
+
+        ITERATE_GLTHREAD_BEGIN(
+                &node_heap->free_block_bins[__builtin_ctzll(bitmap)], curr){
+
+            block_meta_data = glthread_to_block_meta_data(curr);
+            if(MM_BLOCK_SIZE(block_meta_data) < req_size)
+                continue;
+
+            vm_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
+            if(!fullest_block_meta_data ||
+                    vm_page->bytes_in_use > fullest_bytes_in_use){
+                fullest_block_meta_data = block_meta_data;
+                fullest_bytes_in_use = vm_page->bytes_in_use;
+            }
+            if(++scanned == MM_PLACEMENT_SCAN_LIMIT)
+                return fullest_block_meta_data;
+        } ITERATE_GLTHREAD_END(
+                &node_heap->free_block_bins[__builtin_ctzll(bitmap)], curr);
+    }
+    return fullest_block_meta_data;
+}
+
+/* Returns the free block of the node from the smallest non-empty bin
+ * which can satisfy the request, or the block the placement policy of
+ * the family picks. Exact bins guarantee the fit, so only a log spaced
+ * bin shared with the request needs to be searched*/
+static block_meta_data_t *
+mm_get_best_fit_free_block_page_family(
+        vm_page_family_t *vm_page_family,
+        uint32_t node,
+        uint32_t req_size){
+
+    glthread_t *curr = NULL;
+    block_meta_data_t *block_meta_data = NULL;
+    uint32_t scanned = 0;
+    mm_node_heap_t *node_heap = &vm_page_family->node_heaps[node];
+    uint32_t bin_index = mm_free_block_bin_index(vm_page_family, req_size);
+    uint64_t bitmap = node_heap->free_block_bin_bitmap &
+        (~0ULL << bin_index);
+
+    if(!bitmap)
+        return NULL;
+
+    if(vm_page_family->placement == MM_PLACEMENT_FIRST_FIT){
+        return mm_get_first_fit_free_block_page_family(node_heap,
+                bin_index, req_size);
+    }
+    if(vm_page_family->placement == MM_PLACEMENT_FULLEST_PAGE){
+        return mm_get_fullest_page_free_block_page_family(node_heap,
+                bin_index, req_size);
+    }
+
+    if(bin_index < MM_FREE_BLOCK_EXACT_BINS ||
+            (uint32_t)__builtin_ctzll(bitmap) != bin_index){
+
+        curr = node_heap->free_block_bins[__builtin_ctzll(bitmap)].right;
+        return glthread_to_block_meta_data(curr);
+    }
+
+    /*Request shares a log spaced bin, look for a fit in it first*/
+    ITERATE_GLTHREAD_BEGIN(&node_heap->free_block_bins[bin_index], curr){
+
+        block_meta_data = glthread_to_block_meta_data(curr);
+        if(MM_BLOCK_SIZE(block_meta_data) >= req_size)
+            return block_meta_data;
+        if(++scanned == MM_FREE_BLOCK_BIN_SCAN_LIMIT)
+            break;
+    } ITERATE_GLTHREAD_END(&node_heap->free_block_bins[bin_index], curr);
+
+    bitmap &= bitmap - 1;
+    if(bitmap){
+        curr = node_heap->free_block_bins[__builtin_ctzll(bitmap)].right;
+        return glthread_to_block_meta_data(curr);
+    }
+
+    /*Nothing bigger exists, finish the scan of the shared bin*/
+    scanned = 0;
+    ITERATE_GLTHREAD_BEGIN(&node_heap->free_block_bins[bin_index], curr){
+
+        block_meta_data = glthread_to_block_meta_data(curr);
+        if(scanned++ >= MM_FREE_BLOCK_BIN_SCAN_LIMIT &&
+                MM_BLOCK_SIZE(block_meta_data) >= req_size)
+            return block_meta_data;
+    } ITERATE_GLTHREAD_END(&node_heap->free_block_bins[bin_index], curr);
+
+    return NULL;
+}
+
+static vm_page_t *
+mm_family_new_page_add(vm_page_family_t *vm_page_family,
+        uint32_t page_units, uint32_t node){
+
+    vm_page_t *vm_page = allocate_vm_page(vm_page_family, page_units, node);
+
+    if(!vm_page)
+        return NULL;
+
+    /* The new page is like one free block, add it to the
+     * free block list*/
+    mm_add_free_block_meta_data_to_free_block_list(
+            vm_page_family, &vm_page->block_meta_data);
+
+    return vm_page;
+}
+
+/* Marks a free block, already out of any bin, as allocated. The free
+ * block meta data is wiped from a known-zero payload. A purged block
+ * is split beforehand, the split off remainder stays purged*/
+static inline void
+mm_mark_block_allocated(block_meta_data_t *block_meta_data){
+
+    MM_BLOCK_CLEAR(block_meta_data, MM_BLOCK_FREE | MM_BLOCK_PURGED);
+    if(MM_BLOCK_IS(block_meta_data, MM_BLOCK_ZEROED))
+        memset(MM_FREE_BLOCK_GLUE(block_meta_data), 0,
+                MM_FREE_BLOCK_META_SIZE);
+}
+
+/* Shrinks the block to block_size bytes if what remains is big enough
+ * for a block of its own, and returns that new free block which is
+ * not put in any bin yet. Otherwise the block is left untouched*/
+static block_meta_data_t *
+mm_split_block(block_meta_data_t *block_meta_data, uint32_t block_size){
+
+    block_meta_data_t *next_block_meta_data = NULL;
+    uint32_t remaining_size = MM_BLOCK_SIZE(block_meta_data) - block_size;
+
+    if(remaining_size < MM_MIN_BLOCK_FOOTPRINT)
+        return NULL;
+
+    MM_BLOCK_SET_SIZE(block_meta_data, block_size);
+    next_block_meta_data = NEXT_META_BLOCK_BY_SIZE(block_meta_data);
+    /* Footprints add up, the remaining size is the new block's footprint.
+     * Its purged pages lie within those of the block*/
+    next_block_meta_data->size_flags = remaining_size | MM_BLOCK_FREE |
+        (block_meta_data->size_flags & (MM_BLOCK_ZEROED | MM_BLOCK_PURGED));
+    mm_bind_blocks_for_allocation(block_meta_data, next_block_meta_data);
+    return next_block_meta_data;
+}
+
+/* Bytes to carve off the front of the block for its payload to start
+ * at a multiple of 'align'. The carved off part, unless empty, must be
+ * big enough for a free block of its own*/
+static inline uint32_t
+mm_align_pad(block_meta_data_t *block_meta_data, uint32_t align){
+
+    uint32_t pad = (uint32_t)(-(uintptr_t)(block_meta_data + 1) & (align - 1));
+
+    if(pad && pad < MM_MIN_BLOCK_FOOTPRINT)
+        pad += align;
+    return pad;
+}
+
+/* Splits the free block so that a free block with an 'align'ed payload
+ * of at least size bytes follows the carved off front part. Both stay
+ * in the bins. Returns the aligned block, or NULL if the block is too
+ * small*/
+static block_meta_data_t *
+mm_align_free_block(vm_page_family_t *vm_page_family,
+        block_meta_data_t *block_meta_data,
+        uint32_t size, uint32_t align){
+
+    uint32_t pad = mm_align_pad(block_meta_data, align);
+    block_meta_data_t *aligned_block_meta_data = NULL;
+
+    assert(MM_BLOCK_IS(block_meta_data, MM_BLOCK_FREE));
+
+    if(MM_BLOCK_SIZE(block_meta_data) <
+            pad + mm_family_block_size(vm_page_family, size)){
+        return NULL;
+    }
+    if(!pad)
+        return block_meta_data;
+
+    mm_remove_free_block_meta_data_from_free_block_list(
+            vm_page_family, block_meta_data);
+    aligned_block_meta_data = mm_split_block(block_meta_data,
+            pad - sizeof(block_meta_data_t));
+    mm_add_free_block_meta_data_to_free_block_list(
+            vm_page_family, block_meta_data);
+    mm_add_free_block_meta_data_to_free_block_list(
+            vm_page_family, aligned_block_meta_data);
+    return aligned_block_meta_data;
+}
+
+/* Fn to mark block_meta_data as being Allocated for
+ * 'size' bytes of application data. Return TRUE if 
+ * block allocation succeeds*/
+static vm_bool_t
+mm_split_free_data_block_for_allocation(
+            vm_page_family_t *vm_page_family,
+            block_meta_data_t *block_meta_data, 
+            uint32_t size){
+
+    block_meta_data_t *next_block_meta_data = NULL;
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
+
+    assert(MM_BLOCK_IS(block_meta_data, MM_BLOCK_FREE));
+
+    if(MM_BLOCK_SIZE(block_meta_data) < size){
+        return MM_FALSE;
+    }
+
+    mm_remove_free_block_meta_data_from_free_block_list(
+            vm_page_family, block_meta_data);
+
+    /* The remainder becomes a free block of its own, unless it is too
+     * small, in which case the allocated block keeps it*/
+    next_block_meta_data = mm_split_block(block_meta_data,
+            mm_family_block_size(vm_page_family, size));
+    mm_mark_block_allocated(block_meta_data);
+    if(next_block_meta_data){
+        mm_add_free_block_meta_data_to_free_block_list(
+                vm_page_family, next_block_meta_data);
+    }
+
+    vm_page_family->blocks_in_use++;
+    vm_page_family->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+    vm_page->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+    return MM_TRUE;
+}
+
+/* Carves up to n blocks of 'size' bytes back to back out of one free
+ * block in a single pass. The free block leaves its bin once and only
+ * the final remainder is put back. Returns the no of blocks carved*/
+static uint32_t
+mm_carve_free_data_block_for_bulk(
+        vm_page_family_t *vm_page_family,
+        block_meta_data_t *block_meta_data,
+        uint32_t size,
+        uint32_t n,
+        void **out){
+
+    uint32_t count = 0;
+    uint32_t block_size = mm_family_block_size(vm_page_family, size);
+    block_meta_data_t *next_block_meta_data = NULL;
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
+
+    assert(MM_BLOCK_IS(block_meta_data, MM_BLOCK_FREE) &&
+            MM_BLOCK_SIZE(block_meta_data) >= size);
+
+    mm_remove_free_block_meta_data_from_free_block_list(
+            vm_page_family, block_meta_data);
+
+    while(1){
+
+        next_block_meta_data = mm_split_block(block_meta_data, block_size);
+        mm_mark_block_allocated(block_meta_data);
+        out[count++] = (void *)(block_meta_data + 1);
+        vm_page_family->blocks_in_use++;
+        vm_page_family->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+        vm_page->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+        if(!next_block_meta_data)
+            break;
+
+        if(count == n || MM_BLOCK_SIZE(next_block_meta_data) < size){
+            mm_add_free_block_meta_data_to_free_block_list(
+                    vm_page_family, next_block_meta_data);
+            break;
+        }
+        block_meta_data = next_block_meta_data;
+    }
+    return count;
+}
+
+/* Large requests get a VM page of their own. Its single block never
+ * enters the free block bins, freeing it empties the page which then
+ * goes straight back to the kernel. Neither does the free block an
+ * aligned block may be preceded by*/
+static block_meta_data_t *
+mm_allocate_direct_data_block(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size,
+        uint32_t align,
+        uint32_t node){
+
+    uint32_t pad = 0;
+    block_meta_data_t *block_meta_data = NULL;
+    vm_page_t *vm_page = allocate_vm_page(vm_page_family,
+            mm_page_units_for_request(req_size +
+                (align > MM_BLOCK_ALIGN ? MM_ALIGN_PAD_MAX(align) : 0)),
+            node);
+
+    if(!vm_page)
+        return NULL;
+
+    vm_page->is_direct = MM_TRUE;
+    block_meta_data = &vm_page->block_meta_data;
+
+    if(align > MM_BLOCK_ALIGN &&
+            (pad = mm_align_pad(block_meta_data, align))){
+        block_meta_data = mm_split_block(block_meta_data,
+                pad - sizeof(block_meta_data_t));
+        init_glthread(MM_FREE_BLOCK_GLUE(&vm_page->block_meta_data));
+    }
+
+    MM_BLOCK_CLEAR(block_meta_data, MM_BLOCK_FREE);
+    MM_BLOCK_SET_SIZE(block_meta_data, mm_block_size_for_request(req_size));
+    vm_page_family->blocks_in_use++;
+    vm_page_family->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+    vm_page->bytes_in_use = MM_BLOCK_SIZE(block_meta_data);
+    vm_page_family->node_heaps[node].local_allocs++;
+    return block_meta_data;
+}
+
+/* Moves the arena page right after the current one, towards the head
+ * of the page list, so that the unused pages all stay ahead*/
+static void
+mm_arena_page_link(vm_page_family_t *vm_page_family,
+        vm_page_t *arena_page, vm_page_t *vm_page){
+
+    if(!arena_page || arena_page->prev == vm_page)
+        return;
+
+    if(vm_page->prev)
+        vm_page->prev->next = vm_page->next;
+    else
+        vm_page_family->first_page = vm_page->next;
+    if(vm_page->next)
+        vm_page->next->prev = vm_page->prev;
+
+    vm_page->prev = arena_page->prev;
+    vm_page->next = arena_page;
+    if(arena_page->prev)
+        arena_page->prev->next = vm_page;
+    else
+        vm_page_family->first_page = vm_page;
+    arena_page->prev = vm_page;
+}
+
+/* Bumps a block for 'req_size' bytes off the top of the current arena
+ * page. Once it does not fit, the first unused page big enough towards
+ * the head of the page list is taken, else a new page or span is added.
+ * Arena pages serve every node. Caller holds the family_lock*/
+static block_meta_data_t *
+mm_arena_alloc(vm_page_family_t *vm_page_family, uint32_t req_size,
+        uint32_t align){
+
+    uint32_t pad = 0;
+    uint32_t node = mm_numa_current_node();
+    uint32_t block_size = mm_family_block_size(vm_page_family, req_size);
+    vm_page_t *vm_page = vm_page_family->arena_page;
+    vm_page_t *next_vm_page = NULL;
+    block_meta_data_t *block_meta_data = vm_page_family->arena_top;
+
+    if(req_size >= mm_direct_mmap_threshold)
+        return mm_allocate_direct_data_block(vm_page_family,
+                req_size, align, node);
+
+    while(!block_meta_data || MM_BLOCK_SIZE(block_meta_data) <
+            (pad = mm_align_pad(block_meta_data, align)) + block_size){
+
+        /* Direct pages go to the head of the list too. Unused pages too
+         * small for the request are left for the requests to come*/
+        next_vm_page = vm_page ? vm_page->prev : NULL;
+        while(next_vm_page && (next_vm_page->is_direct ||
+                    MM_BLOCK_SIZE(&next_vm_page->block_meta_data) <
+                    mm_align_pad(&next_vm_page->block_meta_data, align) +
+                    block_size)){
+            next_vm_page = next_vm_page->prev;
+        }
+
+        if(!next_vm_page){
+            next_vm_page = allocate_vm_page(vm_page_family,
+                    mm_page_units_for_request(block_size +
+                        (align > MM_BLOCK_ALIGN ? MM_ALIGN_PAD_MAX(align) : 0)),
+                    node);
+            if(!next_vm_page)
+                return NULL;
+        }
+        mm_arena_page_link(vm_page_family, vm_page, next_vm_page);
+        vm_page = next_vm_page;
+        block_meta_data = &vm_page->block_meta_data;
+    }
+
+    /*The carved off front part stays free until the reset*/
+    if(pad)
+        block_meta_data = mm_split_block(block_meta_data,
+                pad - sizeof(block_meta_data_t));
+
+    vm_page_family->arena_page = vm_page;
+    vm_page_family->arena_top = mm_split_block(block_meta_data, block_size);
+    mm_mark_block_allocated(block_meta_data);
+
+    vm_page_family->blocks_in_use++;
+    vm_page_family->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+    vm_page->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+    if(vm_page->numa_node == node)
+        vm_page_family->node_heaps[node].local_allocs++;
+    else
+        vm_page_family->node_heaps[node].remote_allocs++;
+    return block_meta_data;
+}
+
+/* Returns a free block of the node holding req_size bytes aligned to
+ * 'align', split off the front already if need be, or NULL. fit_size
+ * is the size of any free block holding such an aligned block*/
+static block_meta_data_t *
+mm_find_free_data_block(
+        vm_page_family_t *vm_page_family,
+        uint32_t node,
+        uint32_t req_size,
+        uint32_t fit_size,
+        uint32_t align){
+
+    block_meta_data_t *aligned_block_meta_data = NULL;
+    block_meta_data_t *best_fit_block_meta_data =
+        mm_get_best_fit_free_block_page_family(vm_page_family, node, req_size);
+
+    if(!best_fit_block_meta_data || align == MM_BLOCK_ALIGN)
+        return best_fit_block_meta_data;
+
+    /* Freed blocks of aligned families are mostly aligned already,
+     * only look further if the best fit is not big enough once
+     * aligned*/
+    aligned_block_meta_data = mm_align_free_block(vm_page_family,
+            best_fit_block_meta_data, req_size, align);
+    if(!aligned_block_meta_data){
+        best_fit_block_meta_data = mm_get_best_fit_free_block_page_family(
+                vm_page_family, node, fit_size);
+        if(best_fit_block_meta_data){
+            aligned_block_meta_data = mm_align_free_block(vm_page_family,
+                    best_fit_block_meta_data, req_size, align);
+            assert(aligned_block_meta_data);
+        }
+    }
+    return aligned_block_meta_data;
+}
+
+/* Allocates a block of req_size bytes whose payload is aligned to
+ * 'align', at least the alignment of the page family. Blocks come from
+ * the caller's node, those of other nodes are only taken once no new
+ * page can be had*/
+static block_meta_data_t *
+mm_allocate_free_data_block(
+        vm_page_family_t *vm_page_family,
+        uint32_t req_size,
+        uint32_t align){
+    
+    vm_bool_t status = MM_FALSE;
+    vm_page_t *vm_page = NULL;
+    uint32_t fit_size = req_size;
+    uint32_t remote_node = 0;
+    uint32_t node = mm_numa_current_node();
+
+    if(req_size >= mm_direct_mmap_threshold)
+        return mm_allocate_direct_data_block(vm_page_family,
+                req_size, align, node);
+
+    if(align > MM_BLOCK_ALIGN){
+        /* Any free block of fit_size bytes holds an aligned block. It is
+         * a whole no of units, which is all exact bins guarantee*/
+        fit_size = req_size + MM_ALIGN_PAD_MAX(align) + vm_page_family->align;
+        fit_size = (fit_size + vm_page_family->struct_size - 1) /
+            vm_page_family->struct_size * vm_page_family->struct_size;
+    }
+
+    block_meta_data_t *best_fit_block_meta_data = mm_find_free_data_block(
+            vm_page_family, node, req_size, fit_size, align);
+
+    if(!best_fit_block_meta_data){
+
+        /*Spans are limited in size, direct blocks are not*/
+        if(fit_size >= mm_direct_mmap_threshold)
+            return mm_allocate_direct_data_block(vm_page_family,
+                    req_size, align, node);
+
+        /*Time to add a new page (or a multi-page span for requests
+         * bigger than a page) to Page family to satisfy the request*/
+        vm_page = mm_family_new_page_add(vm_page_family,
+                mm_page_units_for_request(fit_size), node);
+
+        if(vm_page){
+            best_fit_block_meta_data = &vm_page->block_meta_data;
+            if(align > MM_BLOCK_ALIGN){
+                best_fit_block_meta_data = mm_align_free_block(vm_page_family,
+                        best_fit_block_meta_data, req_size, align);
+            }
+        }
+    }
+
+    if(best_fit_block_meta_data){
+        vm_page_family->node_heaps[node].local_allocs++;
+    }
+    else {
+        /*The node is out of memory, any node's free block will do*/
+        for( ; remote_node < MM_MAX_NUMA_NODES; remote_node++){
+            if(remote_node == node)
+                continue;
+            best_fit_block_meta_data = mm_find_free_data_block(
+                    vm_page_family, remote_node, req_size, fit_size, align);
+            if(best_fit_block_meta_data)
+                break;
+        }
+        if(!best_fit_block_meta_data)
+            return NULL;
+        vm_page_family->node_heaps[node].remote_allocs++;
+    }
+
+    /*The best fit block meta data can satisfy the request*/
+    status = mm_split_free_data_block_for_allocation(vm_page_family,
+            best_fit_block_meta_data, req_size);
+
+    if(status)
+        return best_fit_block_meta_data;
+
+    return NULL;
+}
+
+vm_page_family_t *
+lookup_page_family_by_name(char *struct_name){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    vm_page_family_curr = mm_lookup_page_family_locked(struct_name);
+    pthread_rwlock_unlock(&mm_registry_lock);
+
+    return vm_page_family_curr;
+}
+
+
+static block_meta_data_t *
+mm_free_blocks(block_meta_data_t *to_be_free_block);
+
+/*Partial slab pages are listed with their node*/
+static void
+mm_slab_partial_add(mm_slab_page_t *slab_page){
+
+    mm_node_heap_t *node_heap = MM_PAGE_NODE_HEAP(&slab_page->vm_page);
+
+    slab_page->prev_partial = NULL;
+    slab_page->next_partial = node_heap->partial_slab_pages;
+    if(node_heap->partial_slab_pages)
+        node_heap->partial_slab_pages->prev_partial = slab_page;
+    node_heap->partial_slab_pages = slab_page;
+}
+
+static void
+mm_slab_partial_remove(mm_slab_page_t *slab_page){
+
+    mm_node_heap_t *node_heap = MM_PAGE_NODE_HEAP(&slab_page->vm_page);
+
+    if(slab_page->prev_partial)
+        slab_page->prev_partial->next_partial = slab_page->next_partial;
+    else
+        node_heap->partial_slab_pages = slab_page->next_partial;
+    if(slab_page->next_partial)
+        slab_page->next_partial->prev_partial = slab_page->prev_partial;
+    slab_page->next_partial = NULL;
+    slab_page->prev_partial = NULL;
+}
+
+/* Adds a new slab page of the node with all of its objects free to
+ * the page family. Caller holds the family_lock*/
+static mm_slab_page_t *
+mm_slab_page_add(vm_page_family_t *vm_page_family, uint32_t node){
+
+    uint32_t i = 0;
+    uint32_t object_count = vm_page_family->slab_object_count;
+    mm_slab_page_t *slab_page =
+        (mm_slab_page_t *)allocate_vm_page(vm_page_family, 1, node);
+
+    if(!slab_page)
+        return NULL;
+
+    if(!mm_page_map_set((void *)slab_page, 1, MM_PAGE_KIND_SLAB)){
+        mm_vm_page_delete_and_free(&slab_page->vm_page);
+        return NULL;
+    }
+
+    slab_page->vm_page.is_slab = MM_TRUE;
+    slab_page->free_count = object_count;
+    /*A recycled page holds stale data everywhere*/
+    slab_page->fresh_index =
+        MM_BLOCK_IS(&slab_page->vm_page.block_meta_data, MM_BLOCK_ZEROED) ?
+        0 : object_count;
+
+    for( ; i < object_count / 64; i++)
+        slab_page->free_bitmap[i] = ~0ULL;
+    if(object_count % 64)
+        slab_page->free_bitmap[i] = (1ULL << (object_count % 64)) - 1;
+
+    /*Objects of a page from the family page cache are constructed still*/
+    if(vm_page_family->ctor && !slab_page->vm_page.is_constructed){
+        for(i = 0; i < object_count; i++){
+            vm_page_family->ctor((char *)slab_page +
+                    vm_page_family->slab_objects_offset +
+                    i * vm_page_family->slab_object_size);
+        }
+        slab_page->vm_page.is_constructed = MM_TRUE;
+    }
+
+    mm_slab_partial_add(slab_page);
+    vm_page_family->blocks_free += object_count;
+    return slab_page;
+}
+
+/* Takes the lowest free object of the first partial slab page of the
+ * caller's node, or of any node once no new page can be had. Caller
+ * holds the family_lock*/
+static void *
+mm_slab_alloc(vm_page_family_t *vm_page_family, vm_bool_t *is_zeroed){
+
+    uint32_t i = 0;
+    uint32_t object_index = 0;
+    uint32_t remote_node = 0;
+    uint32_t node = mm_numa_current_node();
+    mm_slab_page_t *slab_page =
+        vm_page_family->node_heaps[node].partial_slab_pages;
+
+    if(!slab_page)
+        slab_page = mm_slab_page_add(vm_page_family, node);
+
+    if(slab_page){
+        vm_page_family->node_heaps[node].local_allocs++;
+    }
+    else {
+        for( ; remote_node < MM_MAX_NUMA_NODES && !slab_page; remote_node++){
+            slab_page =
+                vm_page_family->node_heaps[remote_node].partial_slab_pages;
+        }
+        if(!slab_page)
+            return NULL;
+        vm_page_family->node_heaps[node].remote_allocs++;
+    }
+
+    /*A partial slab page has at least one bit set*/
+    while(!slab_page->free_bitmap[i])
+        i++;
+    object_index = i * 64 + __builtin_ctzll(slab_page->free_bitmap[i]);
+    slab_page->free_bitmap[i] &= slab_page->free_bitmap[i] - 1;
+
+    if(--slab_page->free_count == 0)
+        mm_slab_partial_remove(slab_page);
+    vm_page_family->blocks_free--;
+    vm_page_family->blocks_in_use++;
+    vm_page_family->bytes_in_use += vm_page_family->struct_size;
+
+    /* Objects are always taken lowest first, so every object below
+     * the lowest free one has been handed out before*/
+    *is_zeroed = object_index >= slab_page->fresh_index;
+    if(*is_zeroed)
+        slab_page->fresh_index = object_index + 1;
+
+    return (char *)slab_page + vm_page_family->slab_objects_offset +
+        object_index * vm_page_family->slab_object_size;
+}
+
+/* Sets the bit of the object back, releasing the slab page once all
+ * of its objects are free. Caller holds the family_lock*/
+static void
+mm_slab_free(mm_slab_page_t *slab_page, void *app_data){
+
+    vm_page_family_t *vm_page_family = slab_page->vm_page.pg_family;
+    uint32_t object_index = (uint32_t)(((uint64_t)((char *)app_data -
+                    (char *)slab_page - vm_page_family->slab_objects_offset) *
+                vm_page_family->slab_size_reciprocal) >> 32);
+    uint64_t bit = 1ULL << (object_index % 64);
+
+    assert(!(slab_page->free_bitmap[object_index / 64] & bit));
+    slab_page->free_bitmap[object_index / 64] |= bit;
+
+    if(++slab_page->free_count == 1)
+        mm_slab_partial_add(slab_page);
+    vm_page_family->blocks_free++;
+    vm_page_family->blocks_in_use--;
+    vm_page_family->bytes_in_use -= vm_page_family->struct_size;
+
+    if(slab_page->free_count == vm_page_family->slab_object_count){
+        mm_slab_partial_remove(slab_page);
+        vm_page_family->blocks_free -= slab_page->free_count;
+        mm_vm_page_delete_and_free(&slab_page->vm_page);
+    }
+}
+
+#define MM_SLAB_PAGE_OF(app_data)   \
+    ((mm_slab_page_t *)((uintptr_t)(app_data) & ~((uintptr_t)SYSTEM_PAGE_SIZE - 1)))
+
+/* Only blocks sized for exactly one unit of the structure are cached,
+ * every block payload can hold the chaining pointer*/
+static inline vm_bool_t
+mm_tcache_is_eligible(vm_page_family_t *vm_page_family,
+        uint32_t block_size){
+
+    if(vm_page_family->family_id < MM_TCACHE_MAX_FAMILIES &&
+            block_size <= MM_TCACHE_MAX_BLOCK_SIZE &&
+            vm_page_family->struct_size < mm_direct_mmap_threshold &&
+            block_size == mm_family_block_size(
+                vm_page_family, vm_page_family->struct_size)){
+        return MM_TRUE;
+    }
+    return MM_FALSE;
+}
+
+static inline void
+mm_tcache_push(mm_tcache_bin_t *tcache_bin,
+        block_meta_data_t *block_meta_data){
+
+    *(void **)(block_meta_data + 1) = tcache_bin->head;
+    tcache_bin->head = (void *)(block_meta_data + 1);
+    tcache_bin->count++;
+}
+
+static inline block_meta_data_t *
+mm_tcache_pop(mm_tcache_bin_t *tcache_bin){
+
+    void *app_data = tcache_bin->head;
+
+    if(!app_data)
+        return NULL;
+
+    tcache_bin->head = *(void **)app_data;
+    tcache_bin->count--;
+    return (block_meta_data_t *)app_data - 1;
+}
+
+/* Accounts the cache hits of the bin to its page family. Caller holds
+ * the family_lock*/
+static inline void
+mm_tcache_bin_merge_stats(mm_tcache_bin_t *tcache_bin){
+
+    tcache_bin->vm_page_family->allocs += tcache_bin->allocs;
+    tcache_bin->vm_page_family->frees += tcache_bin->frees;
+    tcache_bin->allocs = 0;
+    tcache_bin->frees = 0;
+}
+
+/*Return up to 'count' cached blocks of the bin to the page family*/
+static void
+mm_tcache_bin_flush(mm_tcache_bin_t *tcache_bin, uint32_t count){
+
+    block_meta_data_t *block_meta_data = NULL;
+    vm_page_family_t *vm_page_family = tcache_bin->vm_page_family;
+
+    if(!tcache_bin->head && !tcache_bin->allocs && !tcache_bin->frees)
+        return;
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    mm_tcache_bin_merge_stats(tcache_bin);
+    while(count-- && (block_meta_data = mm_tcache_pop(tcache_bin))){
+        mm_free_blocks(block_meta_data);
+    }
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+}
+
+/* Binds the bin to the current incarnation of the page family,
+ * forgetting blocks cached for an unregistered predecessor, whose
+ * pages are gone already*/
+static inline void
+mm_tcache_bin_validate(mm_tcache_bin_t *tcache_bin,
+        vm_page_family_t *vm_page_family){
+
+    /*Exiting threads check bins of families unregistered meanwhile*/
+    uint32_t generation =
+        __atomic_load_n(&vm_page_family->generation, __ATOMIC_RELAXED);
+
+    if(tcache_bin->vm_page_family != vm_page_family ||
+            tcache_bin->generation != generation){
+
+        tcache_bin->head = NULL;
+        tcache_bin->count = 0;
+        tcache_bin->allocs = 0;
+        tcache_bin->frees = 0;
+        tcache_bin->vm_page_family = vm_page_family;
+        tcache_bin->generation = generation;
+    }
+}
+
+static void
+mm_tcache_thread_exit(void *arg){
+
+    uint32_t i = 0;
+    mm_tcache_t *tcache = (mm_tcache_t *)arg;
+
+    for( ; i < MM_TCACHE_MAX_FAMILIES; i++){
+        if(!tcache->bins[i].vm_page_family)
+            continue;
+        mm_tcache_bin_validate(&tcache->bins[i],
+                tcache->bins[i].vm_page_family);
+        mm_tcache_bin_flush(&tcache->bins[i], tcache->bins[i].count);
+    }
+}
+
+static void
+mm_tcache_key_create(){
+
+    pthread_key_create(&mm_tcache_key, mm_tcache_thread_exit);
+}
+
+/* Registers the thread cache for cleanup at thread exit, the
+ * first time the calling thread uses it*/
+static inline mm_tcache_t *
+mm_tcache_get(){
+
+    if(!mm_tcache.initialized){
+        /*Set first, pthread_setspecific() may allocate through us*/
+        mm_tcache.initialized = MM_TRUE;
+        pthread_once(&mm_tcache_key_once, mm_tcache_key_create);
+        pthread_setspecific(mm_tcache_key, &mm_tcache);
+    }
+    return &mm_tcache;
+}
+
+/* Serves a single unit allocation from the thread cache, refilling
+ * the cache with a batch of blocks from the page family on a miss*/
+static block_meta_data_t *
+mm_tcache_alloc(vm_page_family_t *vm_page_family){
+
+    uint32_t i = 0;
+    block_meta_data_t *block_meta_data = NULL;
+    mm_tcache_bin_t *tcache_bin =
+        &mm_tcache_get()->bins[vm_page_family->family_id];
+
+    mm_tcache_bin_validate(tcache_bin, vm_page_family);
+    block_meta_data = mm_tcache_pop(tcache_bin);
+    if(block_meta_data){
+        tcache_bin->allocs++;
+        return block_meta_data;
+    }
+
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    mm_tcache_bin_merge_stats(tcache_bin);
+    for( ; i < MM_TCACHE_BATCH; i++){
+
+        block_meta_data = mm_allocate_free_data_block(vm_page_family,
+                vm_page_family->struct_size, vm_page_family->align);
+        if(!block_meta_data)
+            break;
+        mm_tcache_push(tcache_bin, block_meta_data);
+    }
+    if(tcache_bin->head)
+        vm_page_family->allocs++;
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+
+    return mm_tcache_pop(tcache_bin);
+}
+
+/* Caches a single unit block being freed, flushing a batch back to
+ * the page family when the bin overflows*/
+static vm_bool_t
+mm_tcache_free(block_meta_data_t *block_meta_data){
+
+    vm_page_t *hosting_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
+    vm_page_family_t *vm_page_family = hosting_page->pg_family;
+    mm_tcache_bin_t *tcache_bin = NULL;
+
+    if(!mm_tcache_is_eligible(vm_page_family, MM_BLOCK_SIZE(block_meta_data)))
+        return MM_FALSE;
+
+    tcache_bin = &mm_tcache_get()->bins[vm_page_family->family_id];
+    mm_tcache_bin_validate(tcache_bin, vm_page_family);
+    mm_tcache_push(tcache_bin, block_meta_data);
+    tcache_bin->frees++;
+
+    if(tcache_bin->count > MM_TCACHE_BIN_CAPACITY)
+        mm_tcache_bin_flush(tcache_bin, MM_TCACHE_BATCH);
+
+    return MM_TRUE;
+}
+
+void
+mm_tcache_flush(){
+
+    if(mm_tcache.initialized)
+        mm_tcache_thread_exit(&mm_tcache);
+}
+
+/* The public fn to be invoked by the application for Dynamic
+ * Memory Allocations.*/
+void *
+xcalloc(char *struct_name, int units){
+
+    /*Step 1*/  
+     vm_page_family_t *pg_family =
+             lookup_page_family_by_name(struct_name);
+
+     if(!pg_family){
+
+         printf("Error : Structure %s not registered with Memory Manager\n",
+                 struct_name);
+         return NULL;
+     }
+
+     return xcalloc_h(pg_family, units);
+}
+
+mm_family_handle_t
+mm_get_page_family_handle(char *struct_name){
+
+    return lookup_page_family_by_name(struct_name);
+}
+
+/* Registration ids are never reused, so a handle and id read from
+ * two different updates of the cache can not match either*/
+mm_family_handle_t
+mm_get_cached_page_family_handle(mm_family_handle_cache_t *handle_cache,
+        char *struct_name){
+
+    vm_page_family_t *vm_page_family =
+        __atomic_load_n(&handle_cache->handle, __ATOMIC_RELAXED);
+    uint64_t registration =
+        __atomic_load_n(&handle_cache->registration, __ATOMIC_RELAXED);
+
+    if(vm_page_family && registration == __atomic_load_n(
+                &vm_page_family->registration, __ATOMIC_RELAXED)){
+        return vm_page_family;
+    }
+
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    vm_page_family = mm_lookup_page_family_locked(struct_name);
+    registration = vm_page_family ? vm_page_family->registration : 0;
+    pthread_rwlock_unlock(&mm_registry_lock);
+
+    __atomic_store_n(&handle_cache->handle, vm_page_family, __ATOMIC_RELAXED);
+    __atomic_store_n(&handle_cache->registration, registration,
+            __ATOMIC_RELAXED);
+    return vm_page_family;
+}
+
+/* Allocates 'units' objects of the page family. With 'zero' set the
+ * payload is cleared, unless the block is known to be zero already.
+ * Slab objects and cached blocks only have the family alignment, an
+ * 'align' above it takes a block of its own*/
+static void *
+mm_allocate_units(vm_page_family_t *pg_family, int units, vm_bool_t zero,
+        uint32_t align){
+
+     if(!pg_family){
+
+         printf("Error : Invalid page family handle\n");
+         return NULL;
+     }
+
+     if(units <= 0 || (uint64_t)units * pg_family->struct_size >
+             UINT32_MAX - offset_of(vm_page_t, page_memory) - SYSTEM_PAGE_SIZE){
+
+         printf("Error : Memory Requested Exceeds Max Allocatable Size\n");
+         return NULL;
+     }
+     
+     if(align < pg_family->align)
+         align = pg_family->align;
+
+     if(pg_family->ctor && (units != 1 || align != pg_family->align)){
+
+         printf("Error : Objects of structure %s are constructed one at a "
+                 "time, with the alignment of the structure\n",
+                 pg_family->struct_name);
+         return NULL;
+     }
+
+     if(units == 1 && (pg_family->flags & MM_FAMILY_SLAB) &&
+             align == pg_family->align){
+
+         vm_bool_t is_zeroed = MM_FALSE;
+         pthread_mutex_lock(&pg_family->family_lock);
+         void *app_data = mm_slab_alloc(pg_family, &is_zeroed);
+         if(app_data)
+             pg_family->allocs++;
+         pthread_mutex_unlock(&pg_family->family_lock);
+
+         /*Constructed objects are handed out as they are*/
+         if(app_data && zero && !is_zeroed && !pg_family->ctor)
+             memset(app_data, 0, pg_family->struct_size);
+         return app_data;
+     }
+
+     /*Find the page which can satisfy the request*/
+     block_meta_data_t *free_block_meta_data = NULL;
+
+     if(pg_family->flags & MM_FAMILY_ARENA){
+         pthread_mutex_lock(&pg_family->family_lock);
+         free_block_meta_data = mm_arena_alloc(pg_family,
+                 units * pg_family->struct_size, align);
+         if(free_block_meta_data)
+             pg_family->allocs++;
+         pthread_mutex_unlock(&pg_family->family_lock);
+     }
+     else if(units == 1 && align == pg_family->align &&
+             mm_tcache_is_eligible(pg_family,
+                 mm_family_block_size(pg_family, pg_family->struct_size))){
+
+         free_block_meta_data = mm_tcache_alloc(pg_family);
+         /* Freed blocks are cached without clearing their zeroed flag,
+          * headers are written under the family_lock only, as its
+          * holder reads those of neighbouring blocks*/
+         if(free_block_meta_data && zero){
+             memset((char *)(free_block_meta_data + 1), 0,
+                     MM_BLOCK_SIZE(free_block_meta_data));
+             return (void *)(free_block_meta_data + 1);
+         }
+     }
+     else {
+         pthread_mutex_lock(&pg_family->family_lock);
+         free_block_meta_data = mm_allocate_free_data_block(
+                 pg_family, units * pg_family->struct_size, align);
+         if(free_block_meta_data)
+             pg_family->allocs++;
+         pthread_mutex_unlock(&pg_family->family_lock);
+     }
+
+     if(free_block_meta_data){
+         if(zero && !MM_BLOCK_IS(free_block_meta_data, MM_BLOCK_ZEROED)){
+             memset((char *)(free_block_meta_data + 1), 0, 
+             MM_BLOCK_SIZE(free_block_meta_data));
+         }
+         return  (void *)(free_block_meta_data + 1);
+     }
+
+     return NULL;
+}
+
+static void *
+mm_allocate(vm_page_family_t *pg_family, int units, vm_bool_t zero,
+        uint32_t align){
+
+    uint64_t start_ns = mm_latency_start();
+    void *app_data = mm_allocate_units(pg_family, units, zero, align);
+
+    mm_latency_record(pg_family, MM_LATENCY_ALLOC, start_ns);
+    if(app_data)
+        mm_trace(MM_TRACE_ALLOC, (zero ? MM_TRACE_ZEROED : 0) |
+                (align > MM_BLOCK_ALIGN ?
+                 __builtin_ctz(align) << MM_TRACE_ALIGN_SHIFT : 0),
+                pg_family, units, app_data);
+    return app_data;
+}
+
+/* Same as xcalloc() but for an already resolved page family, the
+ * hot path does no string comparison at all*/
+void *
+xcalloc_h(mm_family_handle_t pg_family, int units){
+
+    return mm_allocate(pg_family, units, MM_TRUE, 0);
+}
+
+/* Like xcalloc() but the memory is not zeroed, for callers which
+ * overwrite the whole object anyway*/
+void *
+xmalloc(char *struct_name, int units){
+
+     vm_page_family_t *pg_family =
+             lookup_page_family_by_name(struct_name);
+
+     if(!pg_family){
+
+         printf("Error : Structure %s not registered with Memory Manager\n",
+                 struct_name);
+         return NULL;
+     }
+
+     return mm_allocate(pg_family, units, MM_FALSE, 0);
+}
+
+void *
+xmalloc_h(mm_family_handle_t pg_family, int units){
+
+    return mm_allocate(pg_family, units, MM_FALSE, 0);
+}
+
+void *
+xcalloc_aligned(mm_family_handle_t pg_family, int units, uint32_t align){
+
+    if(!mm_align_is_valid(align)){
+        printf("Error : %s() Alignment %u is not a power of 2 up to the "
+                "page size\n", __FUNCTION__, align);
+        return NULL;
+    }
+    return mm_allocate(pg_family, units, MM_TRUE, align);
+}
+
+void *
+xmalloc_aligned(mm_family_handle_t pg_family, int units, uint32_t align){
+
+    if(!mm_align_is_valid(align)){
+        printf("Error : %s() Alignment %u is not a power of 2 up to the "
+                "page size\n", __FUNCTION__, align);
+        return NULL;
+    }
+    return mm_allocate(pg_family, units, MM_FALSE, align);
+}
+
+static void
+mm_trace_bulk_alloc(vm_page_family_t *pg_family, void **out, uint32_t count){
+
+    uint32_t i = 0;
+
+    for( ; i < count; i++)
+        mm_trace(MM_TRACE_ALLOC, MM_TRACE_ZEROED, pg_family, 1, out[i]);
+}
+
+int
+xcalloc_bulk(mm_family_handle_t pg_family, int n, void **out){
+
+    uint32_t i = 0;
+    uint32_t count = 0;
+    uint32_t node = 0;
+    uint64_t want_size = 0;
+    vm_page_t *vm_page = NULL;
+    block_meta_data_t *block_meta_data = NULL;
+
+    if(!pg_family || n <= 0)
+        return 0;
+
+    uint32_t size = pg_family->struct_size;
+    /*Room to align the first object of a run*/
+    uint32_t pad_size = pg_family->align > MM_BLOCK_ALIGN ?
+        MM_ALIGN_PAD_MAX(pg_family->align) + pg_family->align : 0;
+
+    if(size + pad_size >= mm_direct_mmap_threshold){
+        /*Every object needs a mapping of its own anyway*/
+        for( ; count < (uint32_t)n; count++){
+            if(!(out[count] = xcalloc_h(pg_family, 1)))
+                break;
+        }
+        return count;
+    }
+
+    pthread_mutex_lock(&pg_family->family_lock);
+
+    if(pg_family->flags & MM_FAMILY_SLAB){
+
+        vm_bool_t is_zeroed = MM_FALSE;
+        for( ; count < (uint32_t)n; count++){
+            if(!(out[count] = mm_slab_alloc(pg_family, &is_zeroed)))
+                break;
+            if(!is_zeroed && !pg_family->ctor)
+                memset(out[count], 0, size);
+        }
+        pg_family->allocs += count;
+        pthread_mutex_unlock(&pg_family->family_lock);
+        mm_trace_bulk_alloc(pg_family, out, count);
+        return count;
+    }
+
+    if(pg_family->flags & MM_FAMILY_ARENA){
+
+        for( ; count < (uint32_t)n; count++){
+            block_meta_data = mm_arena_alloc(pg_family, size, pg_family->align);
+            if(!block_meta_data)
+                break;
+            out[count] = (void *)(block_meta_data + 1);
+            if(!MM_BLOCK_IS(block_meta_data, MM_BLOCK_ZEROED))
+                memset(out[count], 0, MM_BLOCK_SIZE(block_meta_data));
+        }
+        pg_family->allocs += count;
+        pthread_mutex_unlock(&pg_family->family_lock);
+        mm_trace_bulk_alloc(pg_family, out, count);
+        return count;
+    }
+
+    /*Runs are carved on the caller's node only*/
+    node = mm_numa_current_node();
+    while(count < (uint32_t)n){
+
+        /*Room for all the remaining objects in one aligned free run*/
+        want_size = (uint64_t)(n - count) *
+            (mm_family_block_size(pg_family, size) + sizeof(block_meta_data_t)) -
+            sizeof(block_meta_data_t) + pad_size;
+        if(want_size >= mm_direct_mmap_threshold)
+            want_size = mm_direct_mmap_threshold - 1;
+        if(want_size < size + pad_size)
+            want_size = size + pad_size;
+
+        block_meta_data = mm_get_best_fit_free_block_page_family(
+                pg_family, node, (uint32_t)want_size);
+        /*Address ordered bins are not lists, take the first fit there*/
+        if(!block_meta_data && pg_family->placement == MM_PLACEMENT_FIRST_FIT)
+            block_meta_data = mm_get_best_fit_free_block_page_family(
+                    pg_family, node, size + pad_size);
+        else if(!block_meta_data)
+            block_meta_data = mm_get_biggest_free_block_page_family(
+                    pg_family, node);
+
+        if(block_meta_data && pg_family->align > MM_BLOCK_ALIGN){
+            block_meta_data = mm_align_free_block(pg_family,
+                    block_meta_data, size, pg_family->align);
+        }
+
+        if(!block_meta_data || MM_BLOCK_SIZE(block_meta_data) < size){
+
+            vm_page = mm_family_new_page_add(pg_family,
+                    mm_page_units_for_request((uint32_t)want_size), node);
+            if(!vm_page)
+                break;
+            block_meta_data = &vm_page->block_meta_data;
+            if(pg_family->align > MM_BLOCK_ALIGN){
+                block_meta_data = mm_align_free_block(pg_family,
+                        block_meta_data, size, pg_family->align);
+            }
+        }
+
+        count += mm_carve_free_data_block_for_bulk(pg_family,
+                block_meta_data, size, n - count, &out[count]);
+    }
+
+    pg_family->node_heaps[node].local_allocs += count;
+    pg_family->allocs += count;
+    pthread_mutex_unlock(&pg_family->family_lock);
+
+    for( ; i < count; i++){
+        block_meta_data = (block_meta_data_t *)out[i] - 1;
+        if(!MM_BLOCK_IS(block_meta_data, MM_BLOCK_ZEROED))
+            memset(out[i], 0, MM_BLOCK_SIZE(block_meta_data));
+    }
+    mm_trace_bulk_alloc(pg_family, out, count);
+    return count;
+}
+
+/* Marks the block free and merges it with its free neighbours. The
+ * resulting block is returned without being put in a bin. A free
+ * neighbour not sitting in a bin is one freed earlier in the same
+ * xfree_bulk() batch*/
+static block_meta_data_t *
+mm_free_and_merge_block(block_meta_data_t *to_be_free_block){
+
+    block_meta_data_t *return_block = NULL;
+
+    assert(!MM_BLOCK_IS(to_be_free_block, MM_BLOCK_FREE));
+
+    vm_page_t *hosting_page =
+        MM_GET_PAGE_FROM_META_BLOCK(to_be_free_block);
+
+    vm_page_family_t *vm_page_family = hosting_page->pg_family;
+
+    return_block = to_be_free_block;
+
+    vm_page_family->blocks_in_use--;
+    vm_page_family->bytes_in_use -= MM_BLOCK_SIZE(to_be_free_block);
+    hosting_page->bytes_in_use -= MM_BLOCK_SIZE(to_be_free_block);
+
+    MM_BLOCK_SET(to_be_free_block, MM_BLOCK_FREE);
+    MM_BLOCK_CLEAR(to_be_free_block, MM_BLOCK_ZEROED | MM_BLOCK_PURGED);
+    /*Not in any bin yet*/
+    init_glthread(MM_FREE_BLOCK_GLUE(to_be_free_block));
+
+    block_meta_data_t *next_block = NEXT_META_BLOCK(to_be_free_block);
+
+    /*Now perform Merging. Free neighbours leave their bins first
+     * since their size is about to change*/
+    if(next_block && MM_BLOCK_IS(next_block, MM_BLOCK_FREE)){
+        /*Union two free blocks*/
+        if(!IS_GLTHREAD_LIST_EMPTY(MM_FREE_BLOCK_GLUE(next_block))){
+            mm_remove_free_block_meta_data_from_free_block_list(
+                    vm_page_family, next_block);
+        }
+        mm_union_free_blocks(to_be_free_block, next_block);
+        return_block = to_be_free_block;
+    }
+    /*Check the previous block if it was free*/
+    block_meta_data_t *prev_block = PREV_META_BLOCK(to_be_free_block);
+
+    if(prev_block && MM_BLOCK_IS(prev_block, MM_BLOCK_FREE)){
+        if(!IS_GLTHREAD_LIST_EMPTY(MM_FREE_BLOCK_GLUE(prev_block))){
+            mm_remove_free_block_meta_data_from_free_block_list(
+                    vm_page_family, prev_block);
+        }
+        mm_union_free_blocks(prev_block, to_be_free_block);
+        return_block = prev_block;
+    }
+
+    return return_block;
+}
+
+/* Puts a merged free block back in its bin, or releases its VM page
+ * if the block now covers all of it*/
+static block_meta_data_t *
+mm_free_block_release(block_meta_data_t *free_block){
+
+    vm_page_t *hosting_page = MM_GET_PAGE_FROM_META_BLOCK(free_block);
+
+    if(mm_is_vm_page_empty(hosting_page)){
+        mm_vm_page_delete_and_free(hosting_page);
+        return NULL;
+    }
+    mm_free_block_purge(hosting_page->pg_family, free_block);
+    mm_add_free_block_meta_data_to_free_block_list(
+            hosting_page->pg_family, free_block);
+
+    return free_block;
+}
+
+static block_meta_data_t *
+mm_free_blocks(block_meta_data_t *to_be_free_block){
+
+    return mm_free_block_release(
+            mm_free_and_merge_block(to_be_free_block));
+}
+
+
+
+static vm_page_family_t *
+mm_object_family(void *app_data){
+
+    block_meta_data_t *block_meta_data = (block_meta_data_t *)app_data - 1;
+
+    if(mm_page_map_get(app_data) == MM_PAGE_KIND_SLAB)
+        return MM_SLAB_PAGE_OF(app_data)->vm_page.pg_family;
+
+    return ((vm_page_t *)MM_GET_PAGE_FROM_META_BLOCK(block_meta_data))->pg_family;
+}
+
+/*Recorded ahead of the free, the address may be handed out again right away*/
+static inline void
+mm_trace_free(void *app_data){
+
+    if(__atomic_load_n(&mm_tracing, __ATOMIC_RELAXED))
+        mm_trace_record(MM_TRACE_FREE, 0, mm_object_family(app_data), 0,
+                app_data);
+}
+
+/*Frees the object, returns the page family it belonged to*/
+static vm_page_family_t *
+mm_free_object(void *app_data){
+
+    if(mm_page_map_get(app_data) == MM_PAGE_KIND_SLAB){
+
+        mm_slab_page_t *slab_page = MM_SLAB_PAGE_OF(app_data);
+        vm_page_family_t *vm_page_family = slab_page->vm_page.pg_family;
+
+        pthread_mutex_lock(&vm_page_family->family_lock);
+        mm_slab_free(slab_page, app_data);
+        vm_page_family->frees++;
+        pthread_mutex_unlock(&vm_page_family->family_lock);
+        return vm_page_family;
+    }
+
+    block_meta_data_t *block_meta_data =
+        (block_meta_data_t *)((char *)app_data - sizeof(block_meta_data_t));
 
-    block_meta_data_t *block_meta_data1 =
-        (block_meta_data_t *)_block_meta_data1;
+    assert(!MM_BLOCK_IS(block_meta_data, MM_BLOCK_FREE));
 
-    block_meta_data_t *block_meta_data2 =
-        (block_meta_data_t *)_block_meta_data2;
+    vm_page_t *hosting_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
+    vm_page_family_t *vm_page_family = hosting_page->pg_family;
 
-    if(block_meta_data1->block_size > block_meta_data2->block_size)
-        return -1;
-    else if(block_meta_data1->block_size < block_meta_data2->block_size)
-        return 1;
-    return 0;
-}
+    /*Arena blocks stay allocated until mm_arena_reset()*/
+    if((vm_page_family->flags & MM_FAMILY_ARENA) && !hosting_page->is_direct){
+        pthread_mutex_lock(&vm_page_family->family_lock);
+        vm_page_family->frees++;
+        pthread_mutex_unlock(&vm_page_family->family_lock);
+        return vm_page_family;
+    }
 
-static void
-mm_add_free_block_meta_data_to_free_block_list(
-        vm_page_family_t *vm_page_family,
-        block_meta_data_t *free_block){
+    if(mm_tcache_free(block_meta_data))
+        return vm_page_family;
 
-    assert(free_block->is_free == MM_TRUE);
-    glthread_priority_insert(&vm_page_family->free_block_priority_list_head,
-            &free_block->priority_thread_glue,
-            free_blocks_comparison_function,
-            offset_of(block_meta_data_t, priority_thread_glue));
+    pthread_mutex_lock(&vm_page_family->family_lock);
+    mm_free_blocks(block_meta_data);
+    vm_page_family->frees++;
+    pthread_mutex_unlock(&vm_page_family->family_lock);
+    return vm_page_family;
 }
 
-static vm_page_t *
-mm_family_new_page_add(vm_page_family_t *vm_page_family){
+void
+xfree(void *app_data){
 
-    vm_page_t *vm_page = allocate_vm_page(vm_page_family);
+    uint64_t start_ns = mm_latency_start();
+    vm_page_family_t *vm_page_family = NULL;
 
-    if(!vm_page)
-        return NULL;
+    mm_trace_free(app_data);
+    vm_page_family = mm_free_object(app_data);
 
-    /* The new page is like one free block, add it to the
-     * free block list*/
-    mm_add_free_block_meta_data_to_free_block_list(
-            vm_page_family, &vm_page->block_meta_data);
+    mm_latency_record(vm_page_family, MM_LATENCY_FREE, start_ns);
+}
 
-    return vm_page;
+/* Resizes a direct block by remapping its VM page where it lies. A
+ * grown VM page which cannot stay in place is left for relocation.
+ * An aligned block need not be the first one of its VM page*/
+static vm_bool_t
+mm_resize_direct_block(vm_page_family_t *vm_page_family,
+        block_meta_data_t *block_meta_data, uint32_t req_size){
+
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
+    uint32_t page_units = (uint32_t)(((char *)(block_meta_data + 1) -
+                (char *)vm_page + mm_block_size_for_request(req_size) +
+                sizeof(block_meta_data_t) + SYSTEM_PAGE_SIZE - 1) /
+            SYSTEM_PAGE_SIZE);
+    uint32_t old_page_units = vm_page->page_units;
+
+    if(page_units != old_page_units){
+
+        /*Huge chunks are carved out of a shared region*/
+        if(vm_page->is_huge_chunk)
+            return MM_FALSE;
+
+        if(mremap((void *)vm_page, old_page_units * SYSTEM_PAGE_SIZE,
+                    page_units * SYSTEM_PAGE_SIZE, 0) == MAP_FAILED)
+            return MM_FALSE;
+
+        if(page_units > old_page_units &&
+                !mm_page_map_set((void *)vm_page, page_units,
+                    MM_PAGE_KIND_BLOCKS)){
+            /*Shrinking in place cannot fail*/
+            mremap((void *)vm_page, page_units * SYSTEM_PAGE_SIZE,
+                    old_page_units * SYSTEM_PAGE_SIZE, 0);
+            return MM_FALSE;
+        }
+        if(page_units < old_page_units){
+            mm_page_map_set((char *)vm_page + page_units * SYSTEM_PAGE_SIZE,
+                    old_page_units - page_units, MM_PAGE_KIND_NONE);
+        }
+        vm_page->page_units = page_units;
+        vm_page_family->pages_mapped =
+            vm_page_family->pages_mapped - old_page_units + page_units;
+        if(page_units > old_page_units)
+            vm_page_family->page_maps += page_units - old_page_units;
+        else
+            vm_page_family->page_unmaps += old_page_units - page_units;
+        /*The kernel extends the node policy of the mapping*/
+        __atomic_add_fetch(&mm_numa_pages_mapped[vm_page->numa_node],
+                page_units - old_page_units, __ATOMIC_RELAXED);
+    }
+
+    vm_page_family->bytes_in_use -= MM_BLOCK_SIZE(block_meta_data);
+    MM_BLOCK_SET_SIZE(block_meta_data, mm_block_size_for_request(req_size));
+    vm_page_family->bytes_in_use += MM_BLOCK_SIZE(block_meta_data);
+    vm_page->bytes_in_use = MM_BLOCK_SIZE(block_meta_data);
+    return MM_TRUE;
 }
 
-/* Fn to mark block_meta_data as being Allocated for
- * 'size' bytes of application data. Return TRUE if 
- * block allocation succeeds*/
+/* Resizes an allocated block to hold req_size bytes without moving
+ * it. Growing absorbs the next block of the VM page if it is free and
+ * big enough, shrinking splits the tail off as a free block. Returns
+ * MM_FALSE if the block has to be relocated. Caller holds the
+ * family_lock*/
 static vm_bool_t
-mm_split_free_data_block_for_allocation(
-            vm_page_family_t *vm_page_family,
-            block_meta_data_t *block_meta_data, 
-            uint32_t size){
+mm_resize_block_in_place(vm_page_family_t *vm_page_family,
+        block_meta_data_t *block_meta_data, uint32_t req_size){
 
+    uint32_t block_size = mm_family_block_size(vm_page_family, req_size);
+    uint32_t old_size = MM_BLOCK_SIZE(block_meta_data);
+    vm_page_t *vm_page = MM_GET_PAGE_FROM_META_BLOCK(block_meta_data);
     block_meta_data_t *next_block_meta_data = NULL;
+    block_meta_data_t *following_block_meta_data = NULL;
 
-    assert(block_meta_data->is_free == MM_TRUE);
+    if(vm_page->is_direct)
+        return mm_resize_direct_block(vm_page_family, block_meta_data,
+                req_size);
 
-    if(block_meta_data->block_size < size){
+    if(req_size >= mm_direct_mmap_threshold)
         return MM_FALSE;
-    }
 
-    uint32_t remaining_size =
-        block_meta_data->block_size - size;
+    /*Arena blocks neither grow nor give their tail back*/
+    if(vm_page_family->flags & MM_FAMILY_ARENA)
+        return block_size <= old_size;
 
-    block_meta_data->is_free = MM_FALSE;
-    block_meta_data->block_size = size;
-    remove_glthread(&block_meta_data->priority_thread_glue);
-    /*block_meta_data->offset =  ??*/
+    if(block_size > old_size){
 
-    /*Case 1 : No Split*/
-    if(!remaining_size){
-        return MM_TRUE;
-    }
-
-    /*Case 3 : Partial Split : Soft Internal Fragmentation*/
-    else if(sizeof(block_meta_data_t) < remaining_size &&
-            remaining_size < (sizeof(block_meta_data_t) + vm_page_family->struct_size)){
-        /*New Meta block is to be created*/
-        next_block_meta_data = NEXT_META_BLOCK_BY_SIZE(block_meta_data);
-        next_block_meta_data->is_free = MM_TRUE;
-        next_block_meta_data->block_size =
-            remaining_size - sizeof(block_meta_data_t);
-        next_block_meta_data->offset = block_meta_data->offset +
-            sizeof(block_meta_data_t) + block_meta_data->block_size;
-        init_glthread(&next_block_meta_data->priority_thread_glue);
-        mm_add_free_block_meta_data_to_free_block_list(
+        next_block_meta_data = NEXT_META_BLOCK(block_meta_data);
+        if(!next_block_meta_data ||
+                !MM_BLOCK_IS(next_block_meta_data, MM_BLOCK_FREE) ||
+                old_size + sizeof(block_meta_data_t) +
+                MM_BLOCK_SIZE(next_block_meta_data) < block_size){
+            return MM_FALSE;
+        }
+        mm_remove_free_block_meta_data_from_free_block_list(
                 vm_page_family, next_block_meta_data);
-        mm_bind_blocks_for_allocation(block_meta_data, next_block_meta_data);
-    }
-   
-    /*Case 3 : Partial Split : Hard Internal Fragmentation*/
-    else if(remaining_size < sizeof(block_meta_data_t)){
-        /*No need to do anything !!*/
+        /*mm_union_free_blocks() only joins free blocks*/
+        MM_BLOCK_SET(block_meta_data, MM_BLOCK_FREE);
+        mm_union_free_blocks(block_meta_data, next_block_meta_data);
+        MM_BLOCK_CLEAR(block_meta_data, MM_BLOCK_FREE);
     }
 
-    /*Case 2 : Full Split  : New Meta block is Created*/
-    else {
-        /*New Meta block is to be created*/
-        next_block_meta_data = NEXT_META_BLOCK_BY_SIZE(block_meta_data);
-        next_block_meta_data->is_free = MM_TRUE;
-        next_block_meta_data->block_size =
-            remaining_size - sizeof(block_meta_data_t);
-        next_block_meta_data->offset = block_meta_data->offset +
-            sizeof(block_meta_data_t) + block_meta_data->block_size;
-        init_glthread(&next_block_meta_data->priority_thread_glue);
+    /*The split off tail holds application data, it is not zero*/
+    MM_BLOCK_CLEAR(block_meta_data, MM_BLOCK_ZEROED | MM_BLOCK_PURGED);
+    next_block_meta_data = mm_split_block(block_meta_data, block_size);
+
+    if(next_block_meta_data){
+        /*A shrunk block may leave its tail next to a free block*/
+        following_block_meta_data = NEXT_META_BLOCK(next_block_meta_data);
+        if(following_block_meta_data &&
+                MM_BLOCK_IS(following_block_meta_data, MM_BLOCK_FREE)){
+            mm_remove_free_block_meta_data_from_free_block_list(
+                    vm_page_family, following_block_meta_data);
+            mm_union_free_blocks(next_block_meta_data,
+                    following_block_meta_data);
+        }
+        mm_free_block_purge(vm_page_family, next_block_meta_data);
         mm_add_free_block_meta_data_to_free_block_list(
                 vm_page_family, next_block_meta_data);
-        mm_bind_blocks_for_allocation(block_meta_data, next_block_meta_data);
     }
 
+    vm_page_family->bytes_in_use =
+        vm_page_family->bytes_in_use - old_size + MM_BLOCK_SIZE(block_meta_data);
+    vm_page->bytes_in_use =
+        vm_page->bytes_in_use - old_size + MM_BLOCK_SIZE(block_meta_data);
     return MM_TRUE;
-
 }
 
-
-
-static block_meta_data_t *
-mm_allocate_free_data_block(
-        vm_page_family_t *vm_page_family,
-        uint32_t req_size){
-    
-    vm_bool_t status = MM_FALSE;
-    vm_page_t *vm_page = NULL;
+/* Resizes the object to new_units objects of its page family, in place
+ * whenever the VM page allows it. Otherwise the object moves to a new
+ * block, the old one is freed. Grown memory is not zeroed*/
+void *
+xrealloc(void *app_data, int new_units){
+
+    uint64_t start_ns = 0;
+    uint32_t req_size = 0;
+    uint32_t old_size = 0;
+    vm_bool_t resized = MM_FALSE;
+    void *new_app_data = NULL;
+    vm_page_family_t *vm_page_family = NULL;
     block_meta_data_t *block_meta_data = NULL;
 
-    block_meta_data_t *biggest_block_meta_data =
-        mm_get_biggest_free_block_page_family(vm_page_family);
-
-    if(!biggest_block_meta_data ||
-            biggest_block_meta_data->block_size < req_size){
+    if(!app_data){
+        printf("Error : %s() needs an object to find its page family\n",
+                __FUNCTION__);
+        return NULL;
+    }
 
-        /*Time to add a new page to Page family to satisfy the request*/
-        vm_page = mm_family_new_page_add(vm_page_family);
+    if(new_units == 0){
+        xfree(app_data);
+        return NULL;
+    }
 
-        /*Allocate the free block from this page now*/
-        status = mm_split_free_data_block_for_allocation(vm_page_family,
-                &vm_page->block_meta_data, req_size);
+    vm_page_family = mm_object_family(app_data);
 
-        if(status)
-            return &vm_page->block_meta_data;
+    if(new_units < 0 || (uint64_t)new_units * vm_page_family->struct_size >
+            UINT32_MAX - offset_of(vm_page_t, page_memory) - SYSTEM_PAGE_SIZE){
 
+        printf("Error : Memory Requested Exceeds Max Allocatable Size\n");
         return NULL;
     }
-    /*The biggest block meta data can satisfy the request*/
-    if(biggest_block_meta_data){
-        status = mm_split_free_data_block_for_allocation(vm_page_family,
-                biggest_block_meta_data, req_size);
+
+    start_ns = mm_latency_start();
+    mm_trace(MM_TRACE_REALLOC, 0, vm_page_family, new_units, app_data);
+    req_size = new_units * vm_page_family->struct_size;
+
+    if(mm_page_map_get(app_data) == MM_PAGE_KIND_SLAB){
+        /*Slab slots hold exactly one object*/
+        resized = (new_units == 1);
+        old_size = vm_page_family->struct_size;
+    }
+    else {
+        block_meta_data = (block_meta_data_t *)app_data - 1;
+        pthread_mutex_lock(&vm_page_family->family_lock);
+        old_size = MM_BLOCK_SIZE(block_meta_data);
+        resized = mm_resize_block_in_place(vm_page_family,
+                block_meta_data, req_size);
+        pthread_mutex_unlock(&vm_page_family->family_lock);
     }
 
-    if(status)
-        return biggest_block_meta_data;
+    if(resized){
+        new_app_data = app_data;
+    }
+    else {
+        new_app_data = mm_allocate_units(vm_page_family, new_units,
+                MM_FALSE, 0);
+        if(new_app_data){
+            memcpy(new_app_data, app_data,
+                    old_size < req_size ? old_size : req_size);
+            mm_free_object(app_data);
+        }
+    }
 
-    return NULL;
+    mm_latency_record(vm_page_family, MM_LATENCY_ALLOC, start_ns);
+    if(new_app_data)
+        mm_trace(MM_TRACE_ALLOC, MM_TRACE_REALLOCATED, vm_page_family,
+                new_units, new_app_data);
+    return new_app_data;
 }
 
-vm_page_family_t *
-lookup_page_family_by_name(char *struct_name){
+static int
+mm_bulk_pointer_comparison_function(const void *_ptr1, const void *_ptr2){
 
-    vm_page_family_t *vm_page_family_curr = NULL;
-    vm_page_for_families_t *vm_page_for_families_curr = NULL;
+    uintptr_t ptr1 = (uintptr_t)*(void * const *)_ptr1;
+    uintptr_t ptr2 = (uintptr_t)*(void * const *)_ptr2;
 
-    for(vm_page_for_families_curr = first_vm_page_for_families;
-            vm_page_for_families_curr;
-            vm_page_for_families_curr = vm_page_for_families_curr->next){
+    if(ptr1 < ptr2)
+        return -1;
+    return ptr1 > ptr2;
+}
 
-        ITERATE_PAGE_FAMILIES_BEGIN(vm_page_for_families_curr, vm_page_family_curr){
+/* Frees a batch of blocks, reordering the ptrs array by address on
+ * the way. Neighbours freed in the same batch are merged together
+ * first, and every resulting free block is put in a bin only once*/
+void
+xfree_bulk(void **ptrs, int n){
 
-            if(strncmp(vm_page_family_curr->struct_name,
-                        struct_name,
-                        MM_MAX_STRUCT_NAME) == 0){
+    int i = 0;
+    vm_page_family_t *vm_page_family = NULL;
+    vm_page_family_t *locked_vm_page_family = NULL;
+    block_meta_data_t *block_meta_data = NULL;
+    block_meta_data_t *pending_block = NULL;
 
-                return vm_page_family_curr;
-            }
-        } ITERATE_PAGE_FAMILIES_END(vm_page_for_families_curr, vm_page_family_curr);
-    }
-    return NULL;
-}
+    if(n <= 0)
+        return;
 
+    for( ; i < n; i++)
+        mm_trace_free(ptrs[i]);
 
-/* The public fn to be invoked by the application for Dynamic
- * Memory Allocations.*/
-void *
-xcalloc(char *struct_name, int units){
+    qsort(ptrs, n, sizeof(void *), mm_bulk_pointer_comparison_function);
 
-    /*Step 1*/  
-     vm_page_family_t *pg_family =
-             lookup_page_family_by_name(struct_name);
+    for(i = 0; i < n; i++){
 
-     if(!pg_family){
+        mm_slab_page_t *slab_page = NULL;
+        block_meta_data = (block_meta_data_t *)ptrs[i] - 1;
 
-         printf("Error : Structure %s not registered with Memory Manager\n",
-                 struct_name);
-         return NULL;
-     }
+        if(mm_page_map_get(ptrs[i]) == MM_PAGE_KIND_SLAB){
+            slab_page = MM_SLAB_PAGE_OF(ptrs[i]);
+            vm_page_family = slab_page->vm_page.pg_family;
+        }
+        else {
+            assert(!MM_BLOCK_IS(block_meta_data, MM_BLOCK_FREE));
+            vm_page_family =
+                ((vm_page_t *)MM_GET_PAGE_FROM_META_BLOCK(block_meta_data))->pg_family;
+        }
 
-     if(units * pg_family->struct_size > MAX_PAGE_ALLOCATABLE_MEMORY(1)){
+        if(vm_page_family != locked_vm_page_family){
 
-         printf("Error : Memory Requested Exceeds Page Size\n");
-         return NULL;
-     }
-     
-     /*Find the page which can satisfy the request*/
-     block_meta_data_t *free_block_meta_data = NULL;
+            if(locked_vm_page_family){
+                if(pending_block)
+                    mm_free_block_release(pending_block);
+                pending_block = NULL;
+                pthread_mutex_unlock(&locked_vm_page_family->family_lock);
+            }
+            pthread_mutex_lock(&vm_page_family->family_lock);
+            locked_vm_page_family = vm_page_family;
+        }
+        vm_page_family->frees++;
 
-     free_block_meta_data = mm_allocate_free_data_block(
-             pg_family, units * pg_family->struct_size);
+        /*Slab pages never hold headered blocks, pending_block is unaffected*/
+        if(slab_page){
+            mm_slab_free(slab_page, ptrs[i]);
+            continue;
+        }
+        /*Arena blocks stay allocated until mm_arena_reset()*/
+        if((vm_page_family->flags & MM_FAMILY_ARENA) &&
+                !((vm_page_t *)MM_GET_PAGE_FROM_META_BLOCK(
+                        block_meta_data))->is_direct){
+            continue;
+        }
 
-     if(free_block_meta_data){
-         memset((char *)(free_block_meta_data + 1), 0, 
-         free_block_meta_data->block_size);
-         return  (void *)(free_block_meta_data + 1);
-     }
+        block_meta_data = mm_free_and_merge_block(block_meta_data);
 
-     return NULL;
-}
+        /*Not absorbed by this block, so it will not grow any further*/
+        if(pending_block && pending_block != block_meta_data)
+            mm_free_block_release(pending_block);
+        pending_block = block_meta_data;
+    }
 
-static block_meta_data_t *
-mm_free_blocks(block_meta_data_t *to_be_free_block){
+    if(pending_block)
+        mm_free_block_release(pending_block);
+    pthread_mutex_unlock(&locked_vm_page_family->family_lock);
+}
 
-    block_meta_data_t *return_block = NULL;
+vm_bool_t
+mm_is_vm_page_empty(vm_page_t *vm_page){
 
-    assert(to_be_free_block->is_free == MM_FALSE);
+    if(MM_BLOCK_IS(&vm_page->block_meta_data, MM_BLOCK_FREE) &&
+            MM_BLOCK_IS(&vm_page->block_meta_data, MM_BLOCK_LAST)){
 
-    vm_page_t *hosting_page =
-        MM_GET_PAGE_FROM_META_BLOCK(to_be_free_block);
+        return MM_TRUE;
+    }
+    return MM_FALSE;
+}
 
-    vm_page_family_t *vm_page_family = hosting_page->pg_family;
+int
+mm_owns_pointer(void *ptr){
 
-    return_block = to_be_free_block;
+    return mm_page_map_get(ptr) != MM_PAGE_KIND_NONE;
+}
 
-    to_be_free_block->is_free = MM_TRUE;
+size_t
+xusable_size(void *ptr){
 
-    block_meta_data_t *next_block = NEXT_META_BLOCK(to_be_free_block);
+    switch(mm_page_map_get(ptr)){
 
-    /*Handling Hard IF memory*/
-    if(next_block){
-        /* Scenario 1 : When data block to be freed is not the last
-         * upper most meta block in a VM data page*/
-        to_be_free_block->block_size +=
-            mm_get_hard_internal_memory_frag_size (to_be_free_block, next_block);
-    }
-    else {
-        /* Scenario 2: Page Boundry condition*/
-        /* Block being freed is the upper most free data block
-         * in a VM data page, check of hard internal fragmented
-         * memory and merge*/
-        char *end_address_of_vm_page = (char *)((char *)hosting_page + SYSTEM_PAGE_SIZE);
-        char *end_address_of_free_data_block =
-            (char *)(to_be_free_block + 1) + to_be_free_block->block_size;
-        int internal_mem_fragmentation = (int)((unsigned long)end_address_of_vm_page -
-                (unsigned long)end_address_of_free_data_block);
-        to_be_free_block->block_size += internal_mem_fragmentation;
-    }
-
-    /*Now perform Merging*/
-    if(next_block && next_block->is_free == MM_TRUE){
-        /*Union two free blocks*/
-        mm_union_free_blocks(to_be_free_block, next_block);
-        return_block = to_be_free_block;
+        case MM_PAGE_KIND_SLAB:
+            return MM_SLAB_PAGE_OF(ptr)->vm_page.pg_family->struct_size;
+        case MM_PAGE_KIND_BLOCKS:
+            return MM_BLOCK_SIZE((block_meta_data_t *)ptr - 1);
+        default:
+            return 0;
     }
-    /*Check the previous block if it was free*/
-    block_meta_data_t *prev_block = PREV_META_BLOCK(to_be_free_block);
+}
 
-    if(prev_block && prev_block->is_free){
-        mm_union_free_blocks(prev_block, to_be_free_block);
-        return_block = prev_block;
-    }
+mm_family_handle_t
+mm_get_page_family_handle_of(void *ptr){
 
-    if(mm_is_vm_page_empty(hosting_page)){
-        mm_vm_page_delete_and_free(hosting_page);
+    if(!mm_owns_pointer(ptr))
         return NULL;
-    }
-    mm_add_free_block_meta_data_to_free_block_list(
-            hosting_page->pg_family, return_block);
-
-    return return_block;
+    return mm_object_family(ptr);
 }
 
+/* Fork handlers. The forking thread takes every lock of the memory
+ * manager in the order the allocation paths nest them, so the child
+ * starts with consistent page families. Blocks cached by the other
+ * threads are lost to the child*/
+static void
+mm_atfork_prepare(){
 
+    vm_page_family_t *vm_page_family_curr = NULL;
 
-void
-xfree(void *app_data){
+    pthread_mutex_lock(&mm_trace_lock);
+    pthread_rwlock_wrlock(&mm_registry_lock);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families,
+            vm_page_family_curr){
 
-    block_meta_data_t *block_meta_data =
-        (block_meta_data_t *)((char *)app_data - sizeof(block_meta_data_t));
+        pthread_mutex_lock(&vm_page_family_curr->family_lock);
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families,
+            vm_page_family_curr);
+    pthread_mutex_lock(&mm_global_page_cache_lock);
+    pthread_mutex_lock(&mm_huge_region_lock);
+}
 
-    assert(block_meta_data->is_free == MM_FALSE);
-    mm_free_blocks(block_meta_data);
+static void
+mm_atfork_parent(){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    pthread_mutex_unlock(&mm_huge_region_lock);
+    pthread_mutex_unlock(&mm_global_page_cache_lock);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families,
+            vm_page_family_curr){
+
+        pthread_mutex_unlock(&vm_page_family_curr->family_lock);
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families,
+            vm_page_family_curr);
+    pthread_rwlock_unlock(&mm_registry_lock);
+    pthread_mutex_unlock(&mm_trace_lock);
 }
 
-vm_bool_t
-mm_is_vm_page_empty(vm_page_t *vm_page){
+/* The child re-initializes the locks rather than unlocking them, a
+ * write locked rwlock is owned by the thread id of the parent*/
+static void
+mm_atfork_child(){
 
-    if(vm_page->block_meta_data.next_block == NULL &&
-            vm_page->block_meta_data.prev_block == NULL &&
-            vm_page->block_meta_data.is_free == MM_TRUE){
+    vm_page_family_t *vm_page_family_curr = NULL;
 
-        return MM_TRUE;
+    /*Tracing stays with the parent, the flusher thread is not forked*/
+    if(mm_trace_fd >= 0){
+        __atomic_store_n(&mm_tracing, 0, __ATOMIC_SEQ_CST);
+        mm_trace_writers = 0;
+        mm_trace_flusher_run = 0;
+        close(mm_trace_fd);
+        mm_trace_fd = -1;
     }
-    return MM_FALSE;
+
+    pthread_mutex_init(&mm_huge_region_lock, NULL);
+    pthread_mutex_init(&mm_global_page_cache_lock, NULL);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families,
+            vm_page_family_curr){
+
+        pthread_mutex_init(&vm_page_family_curr->family_lock, NULL);
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families,
+            vm_page_family_curr);
+    pthread_rwlock_init(&mm_registry_lock, NULL);
+    pthread_mutex_init(&mm_trace_lock, NULL);
+}
+
+static void
+mm_atfork_register(){
+
+    pthread_atfork(mm_atfork_prepare, mm_atfork_parent, mm_atfork_child);
 }
 
 
@@ -563,34 +3776,47 @@ mm_print_block_usage(){
              occupied_block_count;
     uint32_t application_memory_usage;
 
-    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
 
+        pthread_mutex_lock(&vm_page_family_curr->family_lock);
         total_block_count = 0;
         free_block_count = 0;
         application_memory_usage = 0;
         occupied_block_count = 0;
         ITERATE_VM_PAGE_BEGIN(vm_page_family_curr, vm_page_curr){
 
+            if(vm_page_curr->is_slab){
+                uint32_t slab_free_count =
+                    ((mm_slab_page_t *)vm_page_curr)->free_count;
+                total_block_count += vm_page_family_curr->slab_object_count;
+                free_block_count += slab_free_count;
+                occupied_block_count +=
+                    vm_page_family_curr->slab_object_count - slab_free_count;
+                application_memory_usage += vm_page_family_curr->struct_size *
+                    (vm_page_family_curr->slab_object_count - slab_free_count);
+                continue;
+            }
+
             ITERATE_VM_PAGE_ALL_BLOCKS_BEGIN(vm_page_curr, block_meta_data_curr){
 
                 total_block_count++;
 
-                /*Sanity Checks*/
-                if(block_meta_data_curr->is_free == MM_FALSE){
-                    assert(IS_GLTHREAD_LIST_EMPTY(&block_meta_data_curr->\
-                                priority_thread_glue));
-                }
-                if(block_meta_data_curr->is_free == MM_TRUE){
-                    assert(!IS_GLTHREAD_LIST_EMPTY(&block_meta_data_curr->\
-                                priority_thread_glue));
+                /* Sanity Checks. The pad in front of an aligned direct
+                 * block and the free blocks of arenas are never binned*/
+                if(MM_BLOCK_IS(block_meta_data_curr, MM_BLOCK_FREE) &&
+                        !vm_page_curr->is_direct &&
+                        !(vm_page_family_curr->flags & MM_FAMILY_ARENA)){
+                    assert(!IS_GLTHREAD_LIST_EMPTY(
+                                MM_FREE_BLOCK_GLUE(block_meta_data_curr)));
                 }
 
-                if(block_meta_data_curr->is_free == MM_TRUE){
+                if(MM_BLOCK_IS(block_meta_data_curr, MM_BLOCK_FREE)){
                     free_block_count++;
                 }
                 else{
                     application_memory_usage +=
-                        block_meta_data_curr->block_size + \
+                        MM_BLOCK_SIZE(block_meta_data_curr) + \
                         sizeof(block_meta_data_t);
                     occupied_block_count++;
                 }
@@ -600,8 +3826,10 @@ mm_print_block_usage(){
         printf("%-20s   TBC : %-4u    FBC : %-4u    OBC : %-4u AppMemUsage : %u\n",
                 vm_page_family_curr->struct_name, total_block_count,
                 free_block_count, occupied_block_count, application_memory_usage);
+        pthread_mutex_unlock(&vm_page_family_curr->family_lock);
 
-    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_rwlock_unlock(&mm_registry_lock);
 }
 
 
@@ -613,10 +3841,13 @@ mm_print_memory_usage(char *struct_name){
     vm_page_family_t *vm_page_family_curr;
     uint32_t number_of_struct_families = 0;
     uint32_t cumulative_vm_pages_claimed_from_kernel = 0;
+    uint32_t global_cache_pages = 0;
+    uint64_t global_cache_hits = 0;
 
     printf("\nPage Size = %zu Bytes\n", SYSTEM_PAGE_SIZE);
 
-    ITERATE_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
 
         if(struct_name){
             if(strncmp(struct_name, vm_page_family_curr->struct_name,
@@ -633,14 +3864,22 @@ mm_print_memory_usage(char *struct_name){
                 vm_page_family_curr->struct_size);
         i = 0;
 
+        pthread_mutex_lock(&vm_page_family_curr->family_lock);
+        printf("\t cached pages = %u, page cache hits = %" PRIu64
+                ", misses = %" PRIu64 "\n",
+                vm_page_family_curr->cached_page_count,
+                vm_page_family_curr->page_cache_hits,
+                vm_page_family_curr->page_cache_misses);
         ITERATE_VM_PAGE_BEGIN(vm_page_family_curr, vm_page){
 
-            cumulative_vm_pages_claimed_from_kernel++;
+            cumulative_vm_pages_claimed_from_kernel += vm_page->page_units;
             mm_print_vm_page_details(vm_page);
 
         } ITERATE_VM_PAGE_END(vm_page_family_curr, vm_page);
+        pthread_mutex_unlock(&vm_page_family_curr->family_lock);
         printf("\n");
-    } ITERATE_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_rwlock_unlock(&mm_registry_lock);
 
     printf(ANSI_COLOR_MAGENTA "# Of VM Pages in Use : %u (%lu Bytes)\n" \
             ANSI_COLOR_RESET,
@@ -651,5 +3890,336 @@ mm_print_memory_usage(char *struct_name){
 
     printf("Total Memory being used by Memory Manager = %lu Bytes\n",
             cumulative_vm_pages_claimed_from_kernel * SYSTEM_PAGE_SIZE);
+
+    pthread_mutex_lock(&mm_global_page_cache_lock);
+    global_cache_pages = mm_global_page_cache_count;
+    global_cache_hits = mm_global_page_cache_hits;
+    pthread_mutex_unlock(&mm_global_page_cache_lock);
+    printf("Global page cache : %u pages cached, %" PRIu64 " hits\n",
+            global_cache_pages, global_cache_hits);
+}
+
+
+static void
+mm_family_stats_fill(vm_page_family_t *vm_page_family,
+        mm_family_stats_t *family_stats){
+
+    strncpy(family_stats->struct_name, vm_page_family->struct_name,
+            sizeof(family_stats->struct_name) - 1);
+    family_stats->struct_name[sizeof(family_stats->struct_name) - 1] = '\0';
+    family_stats->struct_size = vm_page_family->struct_size;
+    family_stats->blocks_in_use = vm_page_family->blocks_in_use;
+    family_stats->blocks_free = vm_page_family->blocks_free;
+    family_stats->bytes_in_use = vm_page_family->bytes_in_use;
+    family_stats->pages_mapped = vm_page_family->pages_mapped;
+    family_stats->pages_cached = vm_page_family->cached_page_count;
+    family_stats->allocs = vm_page_family->allocs;
+    family_stats->frees = vm_page_family->frees;
+    family_stats->page_maps = vm_page_family->page_maps;
+    family_stats->page_unmaps = vm_page_family->page_unmaps;
+    family_stats->page_cache_hits = vm_page_family->page_cache_hits;
+    family_stats->bytes_purged = vm_page_family->bytes_purged;
+    family_stats->purges = vm_page_family->purges;
+}
+
+uint32_t
+mm_get_stats(mm_stats_t *stats){
+
+    uint32_t node = 0;
+    uint32_t filled = 0;
+    vm_page_family_t *vm_page_family_curr = NULL;
+
+    stats->family_count = 0;
+    stats->pages_mapped = 0;
+    stats->numa_node_count = mm_numa_node_count();
+    for( ; node < MM_MAX_NUMA_NODES; node++){
+        stats->nodes[node].pages_mapped = __atomic_load_n(
+                &mm_numa_pages_mapped[node], __ATOMIC_RELAXED);
+        stats->nodes[node].local_allocs = 0;
+        stats->nodes[node].remote_allocs = 0;
+    }
+
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        pthread_mutex_lock(&vm_page_family_curr->family_lock);
+        stats->family_count++;
+        stats->pages_mapped += vm_page_family_curr->pages_mapped;
+        for(node = 0; node < MM_MAX_NUMA_NODES; node++){
+            stats->nodes[node].local_allocs +=
+                vm_page_family_curr->node_heaps[node].local_allocs;
+            stats->nodes[node].remote_allocs +=
+                vm_page_family_curr->node_heaps[node].remote_allocs;
+        }
+        if(stats->families && filled < stats->families_capacity){
+            mm_family_stats_fill(vm_page_family_curr,
+                    &stats->families[filled++]);
+        }
+        pthread_mutex_unlock(&vm_page_family_curr->family_lock);
+
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_rwlock_unlock(&mm_registry_lock);
+
+    pthread_mutex_lock(&mm_global_page_cache_lock);
+    stats->global_cache_pages = mm_global_page_cache_count;
+    stats->global_cache_hits = mm_global_page_cache_hits;
+    pthread_mutex_unlock(&mm_global_page_cache_lock);
+    stats->pages_mapped += stats->global_cache_pages;
+
+    pthread_mutex_lock(&mm_huge_region_lock);
+    stats->huge_regions_mapped = mm_huge_region_count;
+    pthread_mutex_unlock(&mm_huge_region_lock);
+
+    return filled;
+}
+
+/*snprintf() into the unused part of the buffer, keeping the full length*/
+typedef struct mm_stats_writer_{
+
+    char *buf;
+    size_t buf_size;
+    int len;
+} mm_stats_writer_t;
+
+static void
+mm_stats_write(mm_stats_writer_t *writer, const char *format, ...){
+
+    va_list args;
+    int n = 0;
+    size_t used = (size_t)writer->len < writer->buf_size ?
+        (size_t)writer->len : writer->buf_size;
+
+    va_start(args, format);
+    n = vsnprintf(writer->buf ? writer->buf + used : NULL,
+            writer->buf ? writer->buf_size - used : 0, format, args);
+    va_end(args);
+
+    if(n > 0)
+        writer->len += n;
+}
+
+/*Struct names are quoted in both formats, escape what would end them*/
+static void
+mm_stats_write_name(mm_stats_writer_t *writer, const char *struct_name){
+
+    uint32_t i = 0;
+
+    for( ; i < MM_MAX_STRUCT_NAME && struct_name[i]; i++){
+        if(struct_name[i] == '"' || struct_name[i] == '\\')
+            mm_stats_write(writer, "\\%c", struct_name[i]);
+        else if((unsigned char)struct_name[i] >= 0x20)
+            mm_stats_write(writer, "%c", struct_name[i]);
+    }
+}
+
+/*Per family counters, in the order of mm_family_stats_t*/
+#define MM_FAMILY_STATS_FIELDS(FIELD)                                           \
+    FIELD(blocks_in_use,   "gauge",   "Allocated blocks, thread cached ones included") \
+    FIELD(blocks_free,     "gauge",   "Free blocks and free slab objects")  \
+    FIELD(bytes_in_use,    "gauge",   "Payload bytes of the allocated blocks") \
+    FIELD(pages_mapped,    "gauge",   "System pages held, page cache included") \
+    FIELD(pages_cached,    "gauge",   "VM pages in the family page cache")  \
+    FIELD(allocs,          "counter", "Allocations")                       \
+    FIELD(frees,           "counter", "Frees")                             \
+    FIELD(page_maps,       "counter", "System pages mapped from the kernel") \
+    FIELD(page_unmaps,     "counter", "System pages given back to the kernel") \
+    FIELD(page_cache_hits, "counter", "VM pages reused from the page caches") \
+    FIELD(bytes_purged,    "gauge",   "Bytes of free blocks given back with madvise") \
+    FIELD(purges,          "counter", "madvise calls on free blocks")
+
+/*Per NUMA node counters, in the order of mm_node_stats_t*/
+#define MM_NODE_STATS_FIELDS(FIELD)                                             \
+    FIELD(pages_mapped,    "gauge",   "System pages bound to the node")    \
+    FIELD(local_allocs,    "counter", "Blocks taken from the free lists of the caller's node") \
+    FIELD(remote_allocs,   "counter", "Blocks taken from another node")
+
+int
+mm_stats_to_json(mm_stats_t *stats, char *buf, size_t buf_size){
+
+    uint32_t i = 0;
+    mm_family_stats_t *family_stats = NULL;
+    mm_stats_writer_t writer = {buf, buf_size, 0};
+    uint32_t filled = stats->families_capacity < stats->family_count ?
+        stats->families_capacity : stats->family_count;
+
+    if(buf && buf_size)
+        buf[0] = '\0';
+
+    mm_stats_write(&writer, "{\"family_count\":%u,\"pages_mapped\":%" PRIu64 ","
+            "\"global_cache_pages\":%" PRIu64 ",\"global_cache_hits\":%" PRIu64 ","
+            "\"huge_regions_mapped\":%" PRIu64 ",\"families\":[",
+            stats->family_count, stats->pages_mapped,
+            stats->global_cache_pages, stats->global_cache_hits,
+            stats->huge_regions_mapped);
+
+    for( ; stats->families && i < filled; i++){
+
+        family_stats = &stats->families[i];
+        mm_stats_write(&writer, "%s{\"struct_name\":\"", i ? "," : "");
+        mm_stats_write_name(&writer, family_stats->struct_name);
+        mm_stats_write(&writer, "\",\"struct_size\":%u",
+                family_stats->struct_size);
+#define MM_STATS_JSON_FIELD(field, type, help)  \
+        mm_stats_write(&writer, ",\"" #field "\":%" PRIu64, family_stats->field);
+        MM_FAMILY_STATS_FIELDS(MM_STATS_JSON_FIELD)
+#undef MM_STATS_JSON_FIELD
+        mm_stats_write(&writer, "}");
+    }
+
+    mm_stats_write(&writer, "],\"nodes\":[");
+    for(i = 0; i < stats->numa_node_count; i++){
+
+        mm_stats_write(&writer, "%s{\"node\":%u", i ? "," : "", i);
+#define MM_STATS_JSON_FIELD(field, type, help)  \
+        mm_stats_write(&writer, ",\"" #field "\":%" PRIu64, stats->nodes[i].field);
+        MM_NODE_STATS_FIELDS(MM_STATS_JSON_FIELD)
+#undef MM_STATS_JSON_FIELD
+        mm_stats_write(&writer, "}");
+    }
+    mm_stats_write(&writer, "]}\n");
+    return writer.len;
+}
+
+int
+mm_stats_to_prometheus(mm_stats_t *stats, char *buf, size_t buf_size){
+
+    uint32_t i = 0;
+    mm_stats_writer_t writer = {buf, buf_size, 0};
+    uint32_t filled = stats->families_capacity < stats->family_count ?
+        stats->families_capacity : stats->family_count;
+
+    if(buf && buf_size)
+        buf[0] = '\0';
+
+    mm_stats_write(&writer,
+            "# HELP mm_pages_mapped System pages held by the memory manager\n"
+            "# TYPE mm_pages_mapped gauge\n"
+            "mm_pages_mapped %" PRIu64 "\n"
+            "# HELP mm_global_cache_pages VM pages in the global page cache\n"
+            "# TYPE mm_global_cache_pages gauge\n"
+            "mm_global_cache_pages %" PRIu64 "\n"
+            "# HELP mm_global_cache_hits_total VM pages reused from the global page cache\n"
+            "# TYPE mm_global_cache_hits_total counter\n"
+            "mm_global_cache_hits_total %" PRIu64 "\n"
+            "# HELP mm_huge_regions_mapped Huge page regions mapped\n"
+            "# TYPE mm_huge_regions_mapped gauge\n"
+            "mm_huge_regions_mapped %" PRIu64 "\n",
+            stats->pages_mapped, stats->global_cache_pages,
+            stats->global_cache_hits, stats->huge_regions_mapped);
+
+#define MM_STATS_PROMETHEUS_FIELD(field, type, help)                            \
+    mm_stats_write(&writer, "# HELP mm_node_" #field "%s " help "\n"            \
+            "# TYPE mm_node_" #field "%s " type "\n",                           \
+            type[0] == 'c' ? "_total" : "", type[0] == 'c' ? "_total" : "");   \
+    for(i = 0; i < stats->numa_node_count; i++){                                \
+        mm_stats_write(&writer, "mm_node_" #field "%s{node=\"%u\"} %" PRIu64    \
+                "\n",                                                           \
+                type[0] == 'c' ? "_total" : "", i, stats->nodes[i].field);      \
+    }
+    MM_NODE_STATS_FIELDS(MM_STATS_PROMETHEUS_FIELD)
+#undef MM_STATS_PROMETHEUS_FIELD
+
+    if(!stats->families)
+        return writer.len;
+
+    /*Counters get the conventional _total suffix*/
+#define MM_STATS_PROMETHEUS_FIELD(field, type, help)                            \
+    mm_stats_write(&writer, "# HELP mm_family_" #field "%s " help "\n"          \
+            "# TYPE mm_family_" #field "%s " type "\n",                         \
+            type[0] == 'c' ? "_total" : "", type[0] == 'c' ? "_total" : "");   \
+    for(i = 0; i < filled; i++){                                                \
+        mm_stats_write(&writer, "mm_family_" #field "%s{family=\"",             \
+                type[0] == 'c' ? "_total" : "");                                \
+        mm_stats_write_name(&writer, stats->families[i].struct_name);          \
+        mm_stats_write(&writer, "\"} %" PRIu64 "\n",                            \
+                stats->families[i].field);                                      \
+    }
+    MM_FAMILY_STATS_FIELDS(MM_STATS_PROMETHEUS_FIELD)
+#undef MM_STATS_PROMETHEUS_FIELD
+
+    return writer.len;
+}
+
+int
+mm_get_latency_histogram(mm_family_handle_t family_handle,
+        mm_latency_op_t op, mm_latency_histogram_t *histogram){
+
+    mm_latency_histograms_t *latency_histograms = NULL;
+
+    if(!family_handle || op >= MM_LATENCY_OPS)
+        return -1;
+
+    latency_histograms = __atomic_load_n(&family_handle->latency_histograms,
+            __ATOMIC_ACQUIRE);
+    if(!latency_histograms)
+        return -1;
+
+    memcpy(histogram, &latency_histograms->op[op], sizeof(*histogram));
+    return 0;
+}
+
+/* Samples recorded while the histograms are being cleared may be
+ * partially lost*/
+void
+mm_reset_latency_histograms(mm_family_handle_t family_handle){
+
+    vm_page_family_t *vm_page_family_curr = NULL;
+    mm_latency_histograms_t *latency_histograms = NULL;
+
+    if(family_handle){
+        latency_histograms = __atomic_load_n(
+                &family_handle->latency_histograms, __ATOMIC_ACQUIRE);
+        if(latency_histograms)
+            memset(latency_histograms, 0, sizeof(*latency_histograms));
+        return;
+    }
+
+    pthread_rwlock_rdlock(&mm_registry_lock);
+    ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families, vm_page_family_curr){
+
+        mm_reset_latency_histograms(vm_page_family_curr);
+    } ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families, vm_page_family_curr);
+    pthread_rwlock_unlock(&mm_registry_lock);
+}
+
+uint64_t
+mm_latency_bucket_lower_ns(uint32_t bucket_index){
+
+    uint32_t exponent = 0;
+
+    if(bucket_index < MM_LATENCY_SUB_BUCKETS)
+        return bucket_index;
+
+    exponent = bucket_index / MM_LATENCY_SUB_BUCKETS +
+        MM_LATENCY_SUB_BUCKET_BITS - 1;
+    return (uint64_t)(MM_LATENCY_SUB_BUCKETS +
+            bucket_index % MM_LATENCY_SUB_BUCKETS) <<
+        (exponent - MM_LATENCY_SUB_BUCKET_BITS);
 }
 
+uint64_t
+mm_latency_percentile(mm_latency_histogram_t *histogram, double percentile){
+
+    uint32_t i = 0;
+    uint64_t seen = 0;
+    uint64_t upper_ns = 0;
+    uint64_t rank = 0;
+
+    if(!histogram->count)
+        return 0;
+
+    rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+    if(rank < 1)
+        rank = 1;
+
+    for( ; i < MM_LATENCY_BUCKETS; i++){
+
+        seen += histogram->buckets[i];
+        if(seen >= rank){
+            upper_ns = i + 1 < MM_LATENCY_BUCKETS ?
+                mm_latency_bucket_lower_ns(i + 1) - 1 : UINT64_MAX;
+            return upper_ns < histogram->max_ns ? upper_ns : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
@@ -2,7 +2,10 @@
 #define __MM__
 
 #include "glthread.h"
+#include "UserAPI_MemoryManager.h"
 #include <stdint.h> /*uint32_t*/
+#include <stddef.h> /*NULL*/
+#include <pthread.h>
 
 typedef enum{
 
@@ -10,17 +13,78 @@ typedef enum{
     MM_TRUE
 } vm_bool_t;
 
+/* Boundary tag of a block. Blocks tile their VM page back to back,
+ * each one being its header followed by the payload. Block footprints
+ * are multiples of MM_BLOCK_ALIGN, which leaves the low bits of
+ * size_flags for the MM_BLOCK_* flags and keeps payloads aligned.
+ * Offsets locate payloads from the start of the page in MM_BLOCK_ALIGN
+ * units, the neighbours of a block are found from its size and from
+ * prev_offset. A free block keeps its free block meta data in its
+ * payload*/
 typedef struct block_meta_data_{
 
-    vm_bool_t is_free;
-    uint32_t block_size;
-    uint32_t offset;    /*offset from the start of the page*/
-    glthread_t priority_thread_glue;
-    struct block_meta_data_ *prev_block;
-    struct block_meta_data_ *next_block;
+    uint32_t size_flags;    /*footprint | MM_BLOCK_* flags*/
+    uint16_t offset;
+    uint16_t prev_offset;   /*of the previous block, 0 for the first one*/
 } block_meta_data_t;
-GLTHREAD_TO_STRUCT(glthread_to_block_meta_data,
-    block_meta_data_t, priority_thread_glue, glthread_ptr);
+
+#define MM_BLOCK_ALIGN      16
+#define MM_BLOCK_FREE       (1 << 0)
+/*Payload holds only zeroes, apart from the meta data of a free block*/
+#define MM_BLOCK_ZEROED     (1 << 1)
+/*Upper most block of its VM page*/
+#define MM_BLOCK_LAST       (1 << 2)
+/* Free block whose whole system pages past its meta data were
+ * released with madvise, see mm_free_block_purge()*/
+#define MM_BLOCK_PURGED     (1 << 3)
+#define MM_BLOCK_FLAGS      (MM_BLOCK_ALIGN - 1)
+
+/* Payload bytes of a free block holding its free list glue and, in
+ * address ordered bins, the biggest block size of its subtree*/
+#define MM_FREE_BLOCK_META_SIZE (sizeof(glthread_t) + sizeof(uint32_t))
+
+/*A free block must be able to hold its meta data*/
+#define MM_MIN_BLOCK_FOOTPRINT  \
+    ((sizeof(block_meta_data_t) + MM_FREE_BLOCK_META_SIZE + \
+      MM_BLOCK_ALIGN - 1) & ~(MM_BLOCK_ALIGN - 1))
+
+/* Most bytes carved off the front of a free block to align its
+ * payload to 'align', see mm_align_pad(). A carved off part must make
+ * a free block of its own*/
+#define MM_ALIGN_PAD_MAX(align) \
+    ((align) + MM_MIN_BLOCK_FOOTPRINT - MM_BLOCK_ALIGN)
+
+/* Block offsets are 16 bit, so VM pages holding more than one block
+ * can not be bigger than this*/
+#define MM_MAX_SPAN_SIZE    ((1 << 16) * MM_BLOCK_ALIGN)
+
+#define MM_BLOCK_IS(block_meta_data_ptr, flag)      \
+    ((block_meta_data_ptr)->size_flags & (flag))
+
+#define MM_BLOCK_SET(block_meta_data_ptr, flag)     \
+    ((block_meta_data_ptr)->size_flags |= (flag))
+
+#define MM_BLOCK_CLEAR(block_meta_data_ptr, flag)   \
+    ((block_meta_data_ptr)->size_flags &= ~(flag))
+
+/*Usable payload bytes of the block*/
+#define MM_BLOCK_SIZE(block_meta_data_ptr)                          \
+    ((uint32_t)(((block_meta_data_ptr)->size_flags & ~MM_BLOCK_FLAGS) \
+        - sizeof(block_meta_data_t)))
+
+#define MM_BLOCK_SET_SIZE(block_meta_data_ptr, block_size)          \
+    ((block_meta_data_ptr)->size_flags =                            \
+        ((block_size) + sizeof(block_meta_data_t)) |                \
+        ((block_meta_data_ptr)->size_flags & MM_BLOCK_FLAGS))
+
+#define MM_FREE_BLOCK_GLUE(block_meta_data_ptr) \
+    ((glthread_t *)((block_meta_data_ptr) + 1))
+
+static inline struct block_meta_data_ *
+glthread_to_block_meta_data(glthread_t *glthread_ptr){
+
+    return (block_meta_data_t *)glthread_ptr - 1;
+}
 
 #define offset_of(container_structure, field_name)  \
     ((size_t)&(((container_structure *)0)->field_name))
@@ -32,72 +96,350 @@ typedef struct vm_page_{
     struct vm_page_ *next;
     struct vm_page_ *prev;
     struct vm_page_family_ *pg_family; /*back pointer*/
+    uint32_t page_units;    /*No of system pages spanned by this VM page*/
+    vm_bool_t is_direct;    /*Dedicated mapping of a single large block*/
+    vm_bool_t is_huge_chunk;/*Carved from a huge page backed region*/
+    vm_bool_t is_slab;      /*Header-less objects, see mm_slab_page_t*/
+    vm_bool_t is_constructed;/*Slab objects went through the family ctor*/
+    uint32_t numa_node;     /*whose free lists and caches the page goes to*/
+    uint32_t bytes_in_use;  /*payload of the allocated blocks, block pages only*/
+    uint32_t reserved;      /*keeps page_memory aligned*/
     block_meta_data_t block_meta_data;
     char page_memory[0];
 } vm_page_t;
 
-#define MM_GET_PAGE_FROM_META_BLOCK(block_meta_data_ptr)    \
-    ((void * )((char *)block_meta_data_ptr - block_meta_data_ptr->offset))
+/* Slab pages of MM_FAMILY_SLAB families hold single unit objects
+ * back to back, without any per object meta data. Free objects are
+ * tracked by the bitmap, a set bit marks a free object. Slab pages
+ * are always one system page, so the page of an object is found by
+ * aligning its address down*/
+typedef struct mm_slab_page_{
+
+    vm_page_t vm_page;  /*block_meta_data is unused*/
+    /*Slab pages of the family having free objects*/
+    struct mm_slab_page_ *next_partial;
+    struct mm_slab_page_ *prev_partial;
+    uint32_t free_count;
+    uint32_t fresh_index;   /*objects from here on are known to be zero*/
+    uint64_t free_bitmap[0];
+} mm_slab_page_t;
+
+/*Below this many objects per page a family keeps its block headers*/
+#define MM_SLAB_MIN_OBJECTS_PER_PAGE    8
+
+/* Page map : a kind byte for every 4 KB of the address space, kept
+ * in a two level radix tree whose leaves are mapped on first use.
+ * xfree() uses it to tell slab objects from headered blocks*/
+typedef enum{
 
-#define NEXT_META_BLOCK(block_meta_data_ptr)                \
-    (block_meta_data_ptr->next_block)
+    MM_PAGE_KIND_NONE,
+    MM_PAGE_KIND_BLOCKS,
+    MM_PAGE_KIND_SLAB
+} mm_page_kind_t;
+
+#define MM_PAGE_MAP_ADDRESS_BITS    48
+#define MM_PAGE_MAP_PAGE_SHIFT      12
+#define MM_PAGE_MAP_LEAF_BITS       20
+#define MM_PAGE_MAP_ROOT_BITS       \
+    (MM_PAGE_MAP_ADDRESS_BITS - MM_PAGE_MAP_PAGE_SHIFT - MM_PAGE_MAP_LEAF_BITS)
+
+_Static_assert(offset_of(vm_page_t, page_memory) % MM_BLOCK_ALIGN == 0,
+        "payload of the first block of a VM page must be aligned");
+
+#define MM_GET_PAGE_FROM_META_BLOCK(block_meta_data_ptr)    \
+    ((void * )((char *)(block_meta_data_ptr + 1) -          \
+        (size_t)block_meta_data_ptr->offset * MM_BLOCK_ALIGN))
 
 #define NEXT_META_BLOCK_BY_SIZE(block_meta_data_ptr)        \
-    (block_meta_data_t *)((char *)(block_meta_data_ptr + 1) \
-        + block_meta_data_ptr->block_size)
+    ((block_meta_data_t *)((char *)(block_meta_data_ptr + 1) \
+        + MM_BLOCK_SIZE(block_meta_data_ptr)))
+
+#define NEXT_META_BLOCK(block_meta_data_ptr)                \
+    (MM_BLOCK_IS(block_meta_data_ptr, MM_BLOCK_LAST) ?      \
+        NULL : NEXT_META_BLOCK_BY_SIZE(block_meta_data_ptr))
 
-#define PREV_META_BLOCK(block_meta_data_ptr)    \
-    (block_meta_data_ptr->prev_block)
+#define PREV_META_BLOCK(block_meta_data_ptr)                \
+    (block_meta_data_ptr->prev_offset ?                     \
+        (block_meta_data_t *)((char *)MM_GET_PAGE_FROM_META_BLOCK(block_meta_data_ptr) \
+            + (size_t)block_meta_data_ptr->prev_offset * MM_BLOCK_ALIGN) - 1 : NULL)
 
+/* Links free_meta_block, carved right after allocated_meta_block, in
+ * between it and its old upper neighbour*/
 #define mm_bind_blocks_for_allocation(allocated_meta_block, free_meta_block)  \
-    free_meta_block->prev_block = allocated_meta_block;        \
-    free_meta_block->next_block = allocated_meta_block->next_block;    \
-    allocated_meta_block->next_block = free_meta_block;                \
-    if (free_meta_block->next_block)                                   \
-    free_meta_block->next_block->prev_block = free_meta_block
+    free_meta_block->offset = allocated_meta_block->offset +               \
+        (MM_BLOCK_SIZE(allocated_meta_block) + sizeof(block_meta_data_t)) / MM_BLOCK_ALIGN; \
+    free_meta_block->prev_offset = allocated_meta_block->offset;           \
+    if (MM_BLOCK_IS(allocated_meta_block, MM_BLOCK_LAST)){                 \
+        MM_BLOCK_CLEAR(allocated_meta_block, MM_BLOCK_LAST);               \
+        MM_BLOCK_SET(free_meta_block, MM_BLOCK_LAST);                      \
+    }                                                                      \
+    else                                                                   \
+        NEXT_META_BLOCK_BY_SIZE(free_meta_block)->prev_offset = free_meta_block->offset
 
 vm_bool_t
 mm_is_vm_page_empty(vm_page_t *vm_page);
 
 #define MM_MAX_STRUCT_NAME 32
+
+/* Free blocks of a page family are kept in segregated bins.
+ * Bins [0, MM_FREE_BLOCK_EXACT_BINS) are exact : bin k holds the
+ * free blocks which can accommodate exactly k units of the structure.
+ * Bins above that are log spaced : each one covers a power of two
+ * range of units. A bitmap records which bins are non-empty so that
+ * insert, remove and fit lookup never walk the whole free list*/
+#define MM_FREE_BLOCK_EXACT_BINS_LOG2   5
+#define MM_FREE_BLOCK_EXACT_BINS        (1 << MM_FREE_BLOCK_EXACT_BINS_LOG2)
+#define MM_FREE_BLOCK_BINS              64
+/* Max no of blocks examined in a log spaced bin before moving
+ * on to the next non-empty bin*/
+#define MM_FREE_BLOCK_BIN_SCAN_LIMIT    8
+/*Fitting blocks compared by the fullest page first placement, all bins*/
+#define MM_PLACEMENT_SCAN_LIMIT         32
+
+/* Free lists, partial slab pages and empty VM pages of a page family
+ * on one NUMA node, guarded by the family_lock*/
+typedef struct mm_node_heap_{
+
+    vm_page_t *cached_pages;    /*chained on their next pointer*/
+    uint32_t cached_page_count;
+    struct mm_slab_page_ *partial_slab_pages;
+    uint64_t local_allocs;
+    uint64_t remote_allocs;     /*by threads of this node*/
+    uint64_t free_block_bin_bitmap; /*bit i is set iff bin i is non-empty*/
+    glthread_t free_block_bins[MM_FREE_BLOCK_BINS];
+} mm_node_heap_t;
+
 typedef struct vm_page_family_{
 
     char struct_name[MM_MAX_STRUCT_NAME];
     uint32_t struct_size;
-    vm_page_t *first_page;
-    glthread_t free_block_priority_list_head;
+    uint32_t family_id; /*registration order, indexes the thread caches*/
+    uint32_t generation;/*bumped on unregistration, invalidates thread caches*/
+    /*Unique per registration, 0 once unregistered. Validates cached handles*/
+    uint64_t registration;
+    struct vm_page_family_ *hash_next; /*registry hash chain or free slot list*/
+    /*Guards the pages and free blocks of this family*/
+    pthread_mutex_t family_lock;
+    vm_page_t *first_page;  /*of all nodes*/
+    /*Empty VM pages retained for reuse, all nodes together*/
+    uint32_t cached_page_count;
+    uint64_t page_cache_hits;
+    uint64_t page_cache_misses;
+    uint64_t page_maps;     /*system pages mapped from the kernel so far*/
+    /* Statistics, all kept up to date under the family_lock. Blocks
+     * sitting in thread caches count as in use*/
+    uint64_t blocks_in_use;
+    uint64_t blocks_free;   /*free blocks in the bins and free slab objects*/
+    uint64_t bytes_in_use;
+    uint64_t pages_mapped;  /*system pages held, page cache included*/
+    uint64_t page_unmaps;   /*system pages given back to the kernel*/
+    uint64_t bytes_purged;  /*madvised away in MM_BLOCK_PURGED free blocks*/
+    uint64_t purges;
+    uint64_t allocs;
+    uint64_t frees;
+    /*Latency histograms, mapped on the first sample*/
+    struct mm_latency_histograms_ *latency_histograms;
+    uint32_t flags;     /*MM_FAMILY_* attributes*/
+    uint32_t align;     /*of every payload, MM_BLOCK_ALIGN at least*/
+    mm_placement_policy_t placement;
+    /*Object caching, slab families only*/
+    mm_object_fn_t ctor;
+    mm_object_fn_t dtor;
+    /* Arena mode : the VM page objects are bumped off and its upper most
+     * free block, NULL once too small for a block. Pages towards the
+     * head of the page list are still unused*/
+    vm_page_t *arena_page;
+    block_meta_data_t *arena_top;
+    /*Slab mode geometry, see mm_slab_page_t*/
+    uint32_t slab_object_count;
+    uint32_t slab_objects_offset;
+    uint32_t slab_object_size;      /*struct_size rounded up to align*/
+    uint32_t slab_size_reciprocal;  /*ceil(2^32 / slab_object_size)*/
+    mm_node_heap_t node_heaps[MM_MAX_NUMA_NODES];
 } vm_page_family_t;
 
 typedef struct vm_page_for_families_{
 
     struct vm_page_for_families_ *next;
+    uint32_t count; /*No of slots handed out so far*/
     vm_page_family_t vm_page_family[0];
 } vm_page_for_families_t;
 
+/* Registry pages are allocated as spans big enough to hold a
+ * reasonable number of page families each*/
+#define MM_MIN_FAMILIES_PER_REGISTRY_PAGE   32
+
+#define MM_REGISTRY_PAGE_UNITS                                          \
+    ((sizeof(vm_page_for_families_t) + MM_MIN_FAMILIES_PER_REGISTRY_PAGE \
+        * sizeof(vm_page_family_t) + SYSTEM_PAGE_SIZE - 1) / SYSTEM_PAGE_SIZE)
+
 #define MAX_FAMILIES_PER_VM_PAGE   \
-    ((SYSTEM_PAGE_SIZE - sizeof(vm_page_for_families_t *))/sizeof(vm_page_family_t))
+    ((SYSTEM_PAGE_SIZE * MM_REGISTRY_PAGE_UNITS - \
+      sizeof(vm_page_for_families_t))/sizeof(vm_page_family_t))
+
+/*Initial no of buckets of the registry hash index, always a power of 2*/
+#define MM_FAMILY_HASH_INITIAL_BUCKETS  64
 
+static inline uint32_t
+mm_free_block_bin_index(vm_page_family_t *vm_page_family,
+        uint32_t block_size){
+
+    uint32_t units = block_size / vm_page_family->struct_size;
+
+    if(units < MM_FREE_BLOCK_EXACT_BINS)
+        return units;
+
+    return MM_FREE_BLOCK_EXACT_BINS +
+        (31 - __builtin_clz(units)) - MM_FREE_BLOCK_EXACT_BINS_LOG2;
+}
+
+#define ITERATE_FREE_BLOCK_BINS_BEGIN(node_heap_ptr, bin_index)          \
+{                                                                         \
+    uint64_t _bitmap = node_heap_ptr->free_block_bin_bitmap;              \
+    for( ; _bitmap; _bitmap &= _bitmap - 1){                              \
+        bin_index = __builtin_ctzll(_bitmap);
+
+#define ITERATE_FREE_BLOCK_BINS_END(node_heap_ptr, bin_index)            \
+    }}
+
+/*Node heap the free blocks and the cache of the VM page belong to*/
+#define MM_PAGE_NODE_HEAP(vm_page_ptr)  \
+    (&(vm_page_ptr)->pg_family->node_heaps[(vm_page_ptr)->numa_node])
+
+/* Returns the biggest free block of the page family on the node. Only
+ * the highest non-empty bin needs to be examined*/
 static inline block_meta_data_t *
 mm_get_biggest_free_block_page_family(
-        vm_page_family_t *vm_page_family){
+        vm_page_family_t *vm_page_family, uint32_t node){
+
+    glthread_t *curr = NULL;
+    block_meta_data_t *block_meta_data = NULL;
+    block_meta_data_t *biggest_block_meta_data = NULL;
+    mm_node_heap_t *node_heap = &vm_page_family->node_heaps[node];
+
+    if(!node_heap->free_block_bin_bitmap)
+        return NULL;
+
+    uint32_t bin_index = 63 - __builtin_clzll(
+            node_heap->free_block_bin_bitmap);
 
-    glthread_t *biggest_free_block_glue =
-        vm_page_family->free_block_priority_list_head.right;
+    ITERATE_GLTHREAD_BEGIN(&node_heap->free_block_bins[bin_index], curr){
 
-    if(biggest_free_block_glue)
-        return glthread_to_block_meta_data(biggest_free_block_glue);
+        block_meta_data = glthread_to_block_meta_data(curr);
+        if(!biggest_block_meta_data ||
+                MM_BLOCK_SIZE(block_meta_data) > MM_BLOCK_SIZE(biggest_block_meta_data)){
+            biggest_block_meta_data = block_meta_data;
+        }
+    } ITERATE_GLTHREAD_END(&node_heap->free_block_bins[bin_index], curr);
 
-    return NULL;
+    return biggest_block_meta_data;
 }
 
 
-vm_page_t *allocate_vm_page(vm_page_family_t *vm_page_family);  // Provide proper prototype
+/* Per thread cache of recently freed single unit blocks, one bin per
+ * page family. Cached blocks stay ALLOCATED as far as the shared page
+ * family is concerned and are chained through the first word of their
+ * payload, so a cache hit touches no lock and no glthread*/
+#define MM_TCACHE_MAX_FAMILIES  128
+#define MM_TCACHE_BIN_CAPACITY  64
+#define MM_TCACHE_BATCH         (MM_TCACHE_BIN_CAPACITY / 4)
+/*Bigger structures are not worth pinning a batch of in every thread*/
+#define MM_TCACHE_MAX_BLOCK_SIZE 1024
+
+typedef struct mm_tcache_bin_{
+
+    void *head;
+    uint32_t count;
+    /*Owner of the cached blocks, valid while its generation matches*/
+    struct vm_page_family_ *vm_page_family;
+    uint32_t generation;
+    /*Cache hits not yet accounted to the page family*/
+    uint32_t allocs;
+    uint32_t frees;
+} mm_tcache_bin_t;
+
+typedef struct mm_tcache_{
+
+    vm_bool_t initialized;
+    mm_tcache_bin_t bins[MM_TCACHE_MAX_FAMILIES];
+} mm_tcache_t;
+
+typedef struct mm_latency_histograms_{
+
+    mm_latency_histogram_t op[MM_LATENCY_OPS];
+} mm_latency_histograms_t;
+
+/* Ring of the allocation trace. A slot whose seq equals the position
+ * of a producer is free to fill, one whose seq is that position + 1
+ * holds an event for the flusher*/
+#define MM_TRACE_RING_EVENTS    (1 << 16)
+/*Yields of a producer facing a full ring before it drops its event*/
+#define MM_TRACE_FULL_RETRIES   1000
+
+typedef struct mm_trace_slot_{
+
+    uint64_t seq;
+    mm_trace_event_t event;
+} mm_trace_slot_t;
+
+typedef struct mm_trace_ring_{
+
+    uint64_t tail;      /*next position claimed by a producer*/
+    char pad0[56];      /*keeps the flusher off the producers' cache line*/
+    uint64_t head;      /*next position read by the flusher*/
+    char pad1[56];
+    mm_trace_slot_t slots[MM_TRACE_RING_EVENTS];
+} mm_trace_ring_t;
+
+/* Requests of at least this many bytes get a VM page of their own
+ * which goes back to the kernel as soon as the block is freed*/
+#define MM_DEFAULT_DIRECT_MMAP_THRESHOLD    (128 * 1024)
+
+/* Free blocks of multi page spans give their whole system pages back
+ * with madvise once these add up to this many bytes. Purging single
+ * pages costs more in syscalls and refaults than it saves*/
+#define MM_DEFAULT_PURGE_THRESHOLD          (16 * 1024)
+
+/* In huge page mode single VM pages are carved out of naturally
+ * aligned regions of MM_HUGE_PAGE_SIZE bytes, backed by transparent
+ * or hugetlbfs huge pages. The region header lives in its first
+ * chunk*/
+#define MM_HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+
+typedef struct mm_huge_region_{
+
+    /*Regions which still have chunks to hand out*/
+    struct mm_huge_region_ *next;
+    struct mm_huge_region_ *prev;
+    void *free_chunks;  /*released chunks, chained through their first word*/
+    uint32_t next_unused_chunk; /*chunks from here on were never handed out*/
+    uint32_t chunk_count;
+    uint32_t chunks_in_use;
+    vm_bool_t is_available;     /*linked on the available regions list*/
+} mm_huge_region_t;
+
+#define MM_HUGE_REGION_FROM_CHUNK(chunk_ptr)   \
+    ((mm_huge_region_t *)((uintptr_t)(chunk_ptr) & ~((uintptr_t)MM_HUGE_PAGE_SIZE - 1)))
+
+/* High watermarks of the empty VM page caches. Once a cache goes
+ * above its watermark it is trimmed down to half of it*/
+#define MM_DEFAULT_FAMILY_PAGE_CACHE_MAX    4
+#define MM_DEFAULT_GLOBAL_PAGE_CACHE_MAX    64
+
+vm_page_t *allocate_vm_page(vm_page_family_t *vm_page_family,
+        uint32_t page_units, uint32_t node);
+
+/*Upper bound of the CPU numbers mapped to their NUMA node*/
+#define MM_NUMA_MAX_CPUS    1024
+/*mbind() policy, <numaif.h> is not required*/
+#define MM_MPOL_PREFERRED   1
 
 
 #define MARK_VM_PAGE_EMPTY(vm_page_t_ptr)                                 \
-    vm_page_t_ptr->block_meta_data.next_block = NULL;                     \
-vm_page_t_ptr->block_meta_data.prev_block = NULL;                         \
-vm_page_t_ptr->block_meta_data.is_free = MM_TRUE
+    vm_page_t_ptr->block_meta_data.size_flags = MM_BLOCK_FREE | MM_BLOCK_LAST; \
+vm_page_t_ptr->block_meta_data.offset =                                   \
+    offset_of(vm_page_t, page_memory) / MM_BLOCK_ALIGN;                   \
+vm_page_t_ptr->block_meta_data.prev_offset = 0
 
 #define ITERATE_VM_PAGE_BEGIN(vm_page_family_ptr, curr)   \
 {                                             \
@@ -119,15 +461,28 @@ vm_page_t_ptr->block_meta_data.is_free = MM_TRUE
 #define ITERATE_VM_PAGE_ALL_BLOCKS_END(vm_page_ptr, curr)      \
     }}
 
+/*Slots of unregistered page families have a zero struct_size and are skipped*/
 #define ITERATE_PAGE_FAMILIES_BEGIN(vm_page_for_families_ptr, curr)                 \
 {                                                                                   \
     uint32_t _count = 0;                                                             \
     for(curr = (vm_page_family_t *)&vm_page_for_families_ptr->vm_page_family[0];    \
-        curr->struct_size && _count < MAX_FAMILIES_PER_VM_PAGE;                      \
-        curr++,_count++){
+        _count < vm_page_for_families_ptr->count;                                   \
+        curr++,_count++){                                                           \
+        if(!curr->struct_size) continue;
 
 #define ITERATE_PAGE_FAMILIES_END(vm_page_for_families_ptr, curr)   }}
 
+/*Iterates the page families of every registry page*/
+#define ITERATE_ALL_PAGE_FAMILIES_BEGIN(first_vm_page_for_families_ptr, curr)      \
+{                                                                                   \
+    vm_page_for_families_t *_vm_page_for_families = first_vm_page_for_families_ptr; \
+    for( ; _vm_page_for_families;                                                   \
+            _vm_page_for_families = _vm_page_for_families->next){                  \
+        ITERATE_PAGE_FAMILIES_BEGIN(_vm_page_for_families, curr)
+
+#define ITERATE_ALL_PAGE_FAMILIES_END(first_vm_page_for_families_ptr, curr)        \
+        ITERATE_PAGE_FAMILIES_END(_vm_page_for_families, curr) }}
+
 vm_page_family_t *
 lookup_page_family_by_name(char *struct_name);
 
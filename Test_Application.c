@@ -1,5 +1,10 @@
 #include "UserAPI_MemoryManager.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
 
 typedef struct emp_ {
 
@@ -17,6 +22,607 @@ typedef struct student_ {
     struct student_ *next;
 } student_t;
 
+#define TEST_THREADS    4
+#define CHURN_ROUNDS    20000
+#define CHURN_LIVE      32
+
+static int
+is_zeroed(void *ptr, size_t size){
+
+    size_t i = 0;
+
+    for(i = 0; i < size; i++){
+        if(((unsigned char *)ptr)[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* Churns both page families, emp_t objects one at a time through the
+ * thread cache and student_t ones of 1 to 3 units through the shared
+ * families, checking that no other thread touched them*/
+static void *
+churn_thread(void *arg){
+
+    int i = 0;
+    int j = 0;
+    uint32_t tag = (uint32_t)(uintptr_t)arg;
+    emp_t *emps[CHURN_LIVE];
+    student_t *studs[CHURN_LIVE];
+
+    memset(emps, 0, sizeof(emps));
+    memset(studs, 0, sizeof(studs));
+    for(i = 0; i < CHURN_ROUNDS; i++){
+
+        j = (i * 7) % CHURN_LIVE;
+        if(emps[j]){
+            assert(emps[j]->emp_id == tag);
+            XFREE(emps[j]);
+        }
+        emps[j] = XCALLOC(1, emp_t);
+        assert(emps[j] && is_zeroed(emps[j], sizeof(emp_t)));
+        emps[j]->emp_id = tag;
+
+        j = (i * 5) % CHURN_LIVE;
+        if(studs[j]){
+            assert(studs[j]->rollno == tag);
+            XFREE(studs[j]);
+        }
+        studs[j] = XCALLOC(1 + i % 3, student_t);
+        assert(studs[j] && is_zeroed(studs[j], (1 + i % 3) * sizeof(student_t)));
+        studs[j]->rollno = tag;
+    }
+    for(j = 0; j < CHURN_LIVE; j++){
+        XFREE(emps[j]);
+        XFREE(studs[j]);
+    }
+    return NULL;
+}
+
+static void
+test_thread_caches(){
+
+    uintptr_t i = 0;
+    pthread_t threads[TEST_THREADS];
+
+    for(i = 0; i < TEST_THREADS; i++)
+        assert(!pthread_create(&threads[i], NULL, churn_thread, (void *)(i + 1)));
+    for(i = 0; i < TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    printf(" \nSCENARIO 4 : thread caches *********** \n");
+    mm_print_block_usage();
+}
+
+#define REGISTRY_ROUNDS 50
+
+/* Registers a page family of its own, of a size no other thread uses,
+ * allocates from it and from emp_t, then unregisters it again*/
+static void *
+registry_thread(void *arg){
+
+    int i = 0;
+    int round = 0;
+    uint32_t tag = (uint32_t)(uintptr_t)arg;
+    char family_name[32];
+    uint32_t *objs[16];
+    emp_t *emps[16];
+
+    snprintf(family_name, sizeof(family_name), "thread_%u_t", tag);
+    for(round = 0; round < REGISTRY_ROUNDS; round++){
+
+        assert(mm_instantiate_new_page_family(family_name, 32 + 16 * tag));
+        for(i = 0; i < 16; i++){
+            objs[i] = xcalloc(family_name, 1 + i % 3);
+            emps[i] = XCALLOC(1, emp_t);
+            assert(objs[i] && is_zeroed(objs[i], (1 + i % 3) * (32 + 16 * tag)));
+            assert(emps[i] && is_zeroed(emps[i], sizeof(emp_t)));
+            objs[i][0] = tag;
+            emps[i]->emp_id = tag;
+        }
+        for(i = 0; i < 16; i++){
+            assert(objs[i][0] == tag && emps[i]->emp_id == tag);
+            XFREE(emps[i]);
+            if(i % 2)
+                XFREE(objs[i]);
+        }
+        /*Drops the objects left, some of them in the thread cache*/
+        mm_unregister_page_family(family_name);
+    }
+    return NULL;
+}
+
+static void
+test_concurrent_registry(){
+
+    uintptr_t i = 0;
+    pthread_t threads[TEST_THREADS];
+
+    for(i = 0; i < TEST_THREADS; i++)
+        assert(!pthread_create(&threads[i], NULL, registry_thread, (void *)(i + 1)));
+    for(i = 0; i < TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    printf(" \nSCENARIO 5 : concurrent registry *********** \n");
+    mm_print_registered_page_families();
+}
+
+typedef struct widget_ {
+
+    uint32_t widget_id;
+    char label[28];
+} widget_t;
+
+typedef struct gadget_ {
+
+    uint64_t serial;
+    char label[56];
+} gadget_t;
+
+static widget_t *
+new_widget(){
+
+    return XCALLOC_T(1, widget_t);
+}
+
+/* A call site of XCALLOC_T() keeps resolving the same structure when
+ * its page family is unregistered and its slot taken by another one*/
+static void
+test_cached_handles(){
+
+    widget_t *widget = NULL;
+    mm_family_handle_t handle = NULL;
+
+    handle = MM_REG_STRUCT(widget_t);
+    widget = new_widget();
+    assert(widget);
+    XFREE(widget);
+    MM_UNREG_STRUCT(widget_t);
+
+    printf(" \nSCENARIO 6 : cached handles *********** \n");
+    /*gadget_t takes the slot widget_t left*/
+    assert(MM_REG_STRUCT(gadget_t) == handle);
+    assert(!new_widget());
+
+    assert(MM_REG_STRUCT(widget_t));
+    widget = new_widget();
+    assert(widget);
+    XFREE(widget);
+    MM_UNREG_STRUCT(widget_t);
+    MM_UNREG_STRUCT(gadget_t);
+}
+
+/* Resizes in place into the free tail of a page and back, moves once
+ * the next block is taken, and resizes a direct mapping. Objects keep
+ * their contents throughout*/
+static void
+test_xrealloc(){
+
+    int i = 0;
+    unsigned char *obj = NULL;
+    unsigned char *resized = NULL;
+    emp_t *neighbour = NULL;
+    mm_family_handle_t handle = mm_instantiate_new_page_family(
+            "emp_resize", sizeof(emp_t));
+
+    assert(handle);
+    obj = xcalloc_h(handle, 2);
+    assert(obj);
+    for(i = 0; i < 2 * (int)sizeof(emp_t); i++)
+        obj[i] = (unsigned char)i;
+
+    printf(" \nSCENARIO 7 : xrealloc *********** \n");
+    assert(xrealloc(obj, 6) == obj);
+    assert(xrealloc(obj, 3) == obj);
+    for(i = 0; i < 2 * (int)sizeof(emp_t); i++)
+        assert(obj[i] == (unsigned char)i);
+
+    neighbour = xcalloc_h(handle, 2);
+    assert(neighbour && (unsigned char *)neighbour > obj);
+    resized = xrealloc(obj, 10);
+    assert(resized && resized != obj);
+    for(i = 0; i < 2 * (int)sizeof(emp_t); i++)
+        assert(resized[i] == (unsigned char)i);
+    mm_print_block_usage();
+    XFREE(neighbour);
+    assert(!xrealloc(resized, 0));
+
+    /*Direct mappings go through mremap, growing moves if it must*/
+    obj = xcalloc_h(handle, 4000);
+    assert(obj);
+    for(i = 0; i < 4000 * (int)sizeof(emp_t); i += 4096)
+        obj[i] = (unsigned char)(i >> 12);
+    resized = xrealloc(obj, 8000);
+    assert(resized);
+    for(i = 0; i < 4000 * (int)sizeof(emp_t); i += 4096)
+        assert(resized[i] == (unsigned char)(i >> 12));
+    assert(xrealloc(resized, 5000) == resized);
+    for(i = 0; i < 4000 * (int)sizeof(emp_t); i += 4096)
+        assert(resized[i] == (unsigned char)(i >> 12));
+    XFREE(resized);
+    mm_unregister_page_family("emp_resize");
+}
+
+/*Aligned objects, the biggest one served from a direct mmap*/
+static void
+test_aligned_allocations(){
+
+    int i = 0;
+    char *big_emp = NULL;
+    emp_t *emps[8];
+    mm_family_handle_t handle = mm_get_page_family_handle("emp_t");
+
+    for(i = 0; i < 8; i++){
+        emps[i] = xcalloc_aligned(handle, 1 + i, 64 << (i % 3));
+        assert(emps[i] && !((uintptr_t)emps[i] & ((64 << (i % 3)) - 1)));
+    }
+    big_emp = xcalloc_aligned(handle, 4000, 256);
+    assert(big_emp && !((uintptr_t)big_emp & 255));
+    for(i = 0; i < 4000 * (int)sizeof(emp_t); i++)
+        assert(!big_emp[i]);
+
+    printf(" \nSCENARIO 8 : aligned allocations *********** \n");
+    mm_tcache_flush();
+    mm_print_block_usage();
+
+    for(i = 0; i < 8; i++)
+        XFREE(emps[i]);
+    XFREE(big_emp);
+    mm_tcache_flush();
+    mm_print_block_usage();
+}
+
+#define NUMA_OBJECTS    200
+
+static int
+shares_page(void *ptr, void **objs, int count){
+
+    int i = 0;
+    uintptr_t page_size = (uintptr_t)getpagesize();
+
+    for(i = 0; i < count; i++){
+        if(objs[i] && (uintptr_t)objs[i] / page_size ==
+                (uintptr_t)ptr / page_size){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Two fake nodes allocate from the same page family. Neither gets
+ * blocks of the pages of the other, not even of those the other just
+ * emptied into its page cache*/
+static void
+test_numa_nodes(){
+
+    int i = 0;
+    int node = 0;
+    void *objs[2][NUMA_OBJECTS];
+    void *obj = NULL;
+    mm_stats_t stats;
+    uint64_t local_allocs[2];
+    mm_family_handle_t handle = mm_instantiate_new_page_family(
+            "emp_numa", sizeof(emp_t));
+
+    assert(handle);
+    memset(objs, 0, sizeof(objs));
+    mm_numa_set_fake_topology(2);
+    assert(mm_numa_node_count() == 2);
+    memset(&stats, 0, sizeof(stats));
+    mm_get_stats(&stats);
+    local_allocs[0] = stats.nodes[0].local_allocs;
+    local_allocs[1] = stats.nodes[1].local_allocs;
+
+    /*Two units, which thread caches do not hold*/
+    for(i = 0; i < NUMA_OBJECTS; i++){
+        for(node = 0; node < 2; node++){
+            mm_numa_set_thread_node(node);
+            objs[node][i] = xcalloc_h(handle, 2);
+            assert(objs[node][i]);
+            assert(!shares_page(objs[node][i], objs[!node], NUMA_OBJECTS));
+        }
+    }
+    mm_get_stats(&stats);
+    assert(stats.numa_node_count == 2);
+    assert(stats.nodes[0].local_allocs - local_allocs[0] == NUMA_OBJECTS);
+    assert(stats.nodes[1].local_allocs - local_allocs[1] == NUMA_OBJECTS);
+    assert(stats.nodes[0].pages_mapped && stats.nodes[1].pages_mapped);
+
+    printf(" \nSCENARIO 9 : NUMA nodes *********** \n");
+    mm_print_block_usage();
+
+    /*The pages of node 1 go to its page cache, node 0 maps its own*/
+    mm_numa_set_thread_node(0);
+    for(i = 0; i < NUMA_OBJECTS; i++)
+        XFREE(objs[1][i]);
+    for(i = 0; i < NUMA_OBJECTS; i++){
+        obj = xcalloc_h(handle, 2);
+        assert(obj && !shares_page(obj, objs[1], NUMA_OBJECTS));
+        XFREE(objs[0][i]);
+        objs[0][i] = obj;
+    }
+    for(i = 0; i < NUMA_OBJECTS; i++)
+        XFREE(objs[0][i]);
+
+    mm_unregister_page_family("emp_numa");
+    mm_numa_set_thread_node(-1);
+    mm_numa_set_fake_topology(0);
+}
+
+/* The same churn under every block placement policy, each in a page
+ * family of its own. Objects keep their contents, and a freed block
+ * below all other free space is reused first*/
+static void
+test_placement_policies(){
+
+    int i = 0;
+    int j = 0;
+    uint32_t policy = 0;
+    char family_name[32];
+    emp_t *emps[64];
+    emp_t *first_emp = NULL;
+    emp_t *probe_emp = NULL;
+    mm_family_attr_t attr;
+    mm_family_handle_t handle = NULL;
+
+    printf(" \nSCENARIO 10 : placement policies *********** \n");
+    for(policy = 0; policy < MM_PLACEMENT_POLICIES; policy++){
+
+        memset(&attr, 0, sizeof(attr));
+        attr.placement = policy;
+        snprintf(family_name, sizeof(family_name), "emp_place_%u", policy);
+        handle = mm_instantiate_new_page_family_ex(family_name,
+                sizeof(emp_t), &attr);
+        assert(handle);
+
+        for(i = 0; i < 64; i++){
+            emps[i] = xcalloc_h(handle, 1 + i % 7);
+            assert(emps[i]);
+            memset(emps[i], i, (1 + i % 7) * sizeof(emp_t));
+        }
+        for(i = 0; i < 64; i += 2){
+            XFREE(emps[i]);
+            emps[i] = xcalloc_h(handle, 1 + (i * 5) % 7);
+            assert(emps[i]);
+            memset(emps[i], i, (1 + (i * 5) % 7) * sizeof(emp_t));
+        }
+        for(i = 0; i < 64; i++){
+            for(j = 0; j < (1 + (i % 2 ? i : i * 5) % 7) *
+                    (int)sizeof(emp_t); j++){
+                assert(((unsigned char *)emps[i])[j] == i);
+            }
+        }
+
+        mm_print_block_usage();
+        for(i = 0; i < 64; i++)
+            XFREE(emps[i]);
+        mm_tcache_flush();
+
+        /*Every policy takes the only fitting block below the tail*/
+        first_emp = xcalloc_h(handle, 4);
+        probe_emp = xcalloc_h(handle, 4);
+        XFREE(first_emp);
+        mm_tcache_flush();
+        assert(xcalloc_h(handle, 4) == first_emp);
+        XFREE(first_emp);
+        XFREE(probe_emp);
+
+        mm_unregister_page_family(family_name);
+    }
+}
+
+static mm_family_stats_t *
+family_stats_of(char *struct_name, mm_family_stats_t *family_stats,
+        uint32_t capacity){
+
+    uint32_t i = 0;
+    mm_stats_t stats;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.families = family_stats;
+    stats.families_capacity = capacity;
+    mm_get_stats(&stats);
+    for(i = 0; i < stats.family_count && i < capacity; i++){
+        if(!strcmp(family_stats[i].struct_name, struct_name))
+            return &family_stats[i];
+    }
+    return NULL;
+}
+
+/* Drops live objects and objects sitting in the thread cache at once.
+ * The page family is empty afterwards, keeps only cached pages, and
+ * serves fresh objects again, none of the stale cached ones*/
+static void
+test_release_all(){
+
+    int i = 0;
+    emp_t *emps[300];
+    mm_family_stats_t family_stats[8];
+    mm_family_stats_t *stats = NULL;
+    mm_family_handle_t handle = mm_instantiate_new_page_family(
+            "emp_teardown", sizeof(emp_t));
+
+    assert(handle);
+    for(i = 0; i < 300; i++){
+        emps[i] = xcalloc_h(handle, 1 + i % 7);
+        assert(emps[i]);
+    }
+    /*Single units freed here stay in the thread cache*/
+    for(i = 0; i < 300; i += 7)
+        XFREE(emps[i]);
+    stats = family_stats_of("emp_teardown", family_stats, 8);
+    assert(stats && stats->blocks_in_use >= 300 - 43 && stats->pages_mapped);
+
+    printf(" \nSCENARIO 11 : release all *********** \n");
+    mm_family_release_all(handle);
+    stats = family_stats_of("emp_teardown", family_stats, 8);
+    assert(stats && !stats->blocks_in_use && !stats->blocks_free &&
+            !stats->bytes_in_use);
+    /*Single page VM pages only, each of them cached or unmapped*/
+    assert(stats->pages_mapped == stats->pages_cached);
+
+    for(i = 0; i < 100; i++){
+        emps[i] = xcalloc_h(handle, 1);
+        assert(emps[i] && is_zeroed(emps[i], sizeof(emp_t)));
+        emps[i]->emp_id = i;
+    }
+    for(i = 0; i < 100; i++)
+        assert(emps[i]->emp_id == (uint32_t)i);
+    mm_tcache_flush();
+    stats = family_stats_of("emp_teardown", family_stats, 8);
+    assert(stats && stats->blocks_in_use == 100);
+    mm_print_block_usage();
+
+    for(i = 0; i < 100; i++)
+        XFREE(emps[i]);
+    mm_unregister_page_family("emp_teardown");
+}
+
+static uint64_t
+family_pages_mapped(char *struct_name){
+
+    mm_family_stats_t family_stats[8];
+    mm_family_stats_t *stats = family_stats_of(struct_name, family_stats, 8);
+
+    return stats ? stats->pages_mapped : 0;
+}
+
+/* Two rounds of request scoped objects in an arena, aligned and direct
+ * ones included. The reset between them keeps the pages, which the
+ * second round reuses*/
+static void
+test_arena(){
+
+    int i = 0;
+    int j = 0;
+    int round = 0;
+    uint64_t pages_mapped = 0;
+    unsigned char *objs[300];
+    mm_family_attr_t attr;
+    mm_family_handle_t handle = NULL;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.flags = MM_FAMILY_ARENA;
+    handle = mm_instantiate_new_page_family_ex("emp_arena",
+            sizeof(emp_t), &attr);
+    assert(handle);
+
+    printf(" \nSCENARIO 12 : arena *********** \n");
+    for(round = 0; round < 2; round++){
+
+        for(i = 0; i < 300; i++){
+            if(i == 150)
+                objs[i] = xcalloc_h(handle, 4000);
+            else if(i % 10 == 0)
+                objs[i] = xcalloc_aligned(handle, 1 + i % 7, 128);
+            else
+                objs[i] = xcalloc_h(handle, 1 + i % 7);
+            assert(objs[i]);
+            assert(i % 10 || i == 150 || !((uintptr_t)objs[i] & 127));
+            for(j = 0; j < (i == 150 ? 4000 : 1 + i % 7) *
+                    (int)sizeof(emp_t); j++){
+                assert(!objs[i][j]);
+                objs[i][j] = (unsigned char)i;
+            }
+        }
+        /*Frees before the reset only count*/
+        for(i = 0; i < 300; i += 3)
+            XFREE(objs[i]);
+        for(i = 1; i < 300; i += 3)
+            assert(objs[i][0] == (unsigned char)i);
+
+        mm_print_block_usage();
+        if(!round)
+            pages_mapped = family_pages_mapped("emp_arena");
+        else
+            assert(family_pages_mapped("emp_arena") == pages_mapped);
+        mm_arena_reset(handle);
+    }
+    mm_print_block_usage();
+    mm_unregister_page_family("emp_arena");
+}
+
+typedef struct session_ {
+
+    uint32_t magic;
+    uint32_t state;
+    char buf[40];
+} session_t;
+
+#define SESSION_MAGIC   0x5e551011
+
+static int sessions_constructed = 0;
+static int sessions_destructed = 0;
+
+static void
+session_ctor(void *obj){
+
+    session_t *session = obj;
+
+    session->magic = SESSION_MAGIC;
+    session->state = 0;
+    sessions_constructed++;
+}
+
+static void
+session_dtor(void *obj){
+
+    session_t *session = obj;
+
+    assert(session->magic == SESSION_MAGIC);
+    session->magic = 0;
+    sessions_destructed++;
+}
+
+/* Objects of a ctor family come back constructed, xcalloc() included,
+ * and every constructed object is destructed once, when release_all
+ * drops live objects too*/
+static void
+test_object_caching(){
+
+    int i = 0;
+    int round = 0;
+    session_t *sessions[100];
+    mm_family_attr_t attr;
+    mm_family_handle_t handle = NULL;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.dtor = session_dtor;
+    assert(!MM_REG_STRUCT_EX(session_t, &attr));
+    attr.ctor = session_ctor;
+    handle = MM_REG_STRUCT_EX(session_t, &attr);
+    assert(handle);
+    assert(!xcalloc_h(handle, 2));
+
+    printf(" \nSCENARIO 13 : object caching *********** \n");
+    for(round = 0; round < 3; round++){
+
+        for(i = 0; i < 100; i++){
+            sessions[i] = xcalloc_h(handle, 1);
+            assert(sessions[i]->magic == SESSION_MAGIC);
+            assert(sessions[i]->state == 0);
+            sessions[i]->state = 0xdead;
+        }
+        /*Freed objects are left constructed by their owner*/
+        for(i = 0; i < 50; i++){
+            sessions[i]->state = 0;
+            XFREE(sessions[i]);
+        }
+        mm_print_block_usage();
+        /*Drops the other 50 as they are*/
+        mm_family_release_all(handle);
+        assert(sessions_constructed == sessions_destructed);
+    }
+
+    sessions[0] = xcalloc_h(handle, 1);
+    assert(sessions[0]->state == 0);
+    XFREE(sessions[0]);
+    MM_UNREG_STRUCT(session_t);
+    assert(sessions_constructed == sessions_destructed);
+    printf("sessions constructed %d, destructed %d\n",
+            sessions_constructed, sessions_destructed);
+}
+
 int
 main(int argc, char **argv){
 
@@ -34,6 +640,7 @@ main(int argc, char **argv){
     student_t *stud2 = XCALLOC(1, student_t);
 
     printf(" \nSCENARIO 1 : *********** \n");
+    mm_tcache_flush();
     mm_print_memory_usage(0);
     mm_print_block_usage();
 
@@ -44,6 +651,7 @@ main(int argc, char **argv){
     XFREE(emp3);
     XFREE(stud2);
     printf(" \nSCENARIO 2 : *********** \n");
+    mm_tcache_flush();
     mm_print_memory_usage(0);
     mm_print_block_usage();
 
@@ -53,7 +661,19 @@ main(int argc, char **argv){
     XFREE(emp2);
     XFREE(stud1);
     printf(" \nSCENARIO 3 : *********** \n");
+    mm_tcache_flush();
     mm_print_memory_usage(0);
     mm_print_block_usage();
+
+    test_thread_caches();
+    test_concurrent_registry();
+    test_cached_handles();
+    test_xrealloc();
+    test_aligned_allocations();
+    test_numa_nodes();
+    test_placement_policies();
+    test_release_all();
+    test_arena();
+    test_object_caching();
     return 0; 
 }
\ No newline at end of file
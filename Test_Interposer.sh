@@ -0,0 +1,29 @@
+#!/bin/sh
+# Preload smoke test of libmm_malloc.so : builds the shim, then has the
+# compiler, itself running on the shim, compile the memory manager.
+# gcc and binutils carry libiberty's xmalloc(size_t), which a leaked
+# xmalloc() of ours would override.
+#
+# sh Test_Interposer.sh
+
+set -e
+cd "$(dirname "$0")"
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+gcc -O2 -fPIC -shared -pthread -ftls-model=initial-exec \
+    -fvisibility=hidden -Wl,-Bsymbolic-functions \
+    MM_Interposer.c MemoryManager.c glthread.c -o "$out/libmm_malloc.so" -ldl
+
+# Nothing but the malloc() family may be exported
+exported=$(nm -D --defined-only "$out/libmm_malloc.so" | awk '{print $3}' |
+    grep -v -x -E 'malloc|calloc|free|realloc|posix_memalign|aligned_alloc|memalign|valloc|pvalloc|malloc_usable_size' || true)
+if [ -n "$exported" ]; then
+    echo "Error : libmm_malloc.so exports $exported"
+    exit 1
+fi
+
+LD_PRELOAD="$out/libmm_malloc.so" gcc -O2 -pthread \
+    Test_Application.c MemoryManager.c glthread.c -o "$out/test_app"
+echo 1 2 | LD_PRELOAD="$out/libmm_malloc.so" "$out/test_app" > /dev/null
+echo "Interposer OK"
@@ -0,0 +1,450 @@
+/* Replays an allocation trace recorded with mm_trace_start() against
+ * the memory manager, so that placement policies and tunables can be
+ * compared on a real workload offline. Events are replayed in the
+ * order they were recorded by a single thread. Families are registered
+ * under synthetic names with the recorded size and flags. An xrealloc()
+ * is replayed at its MM_TRACE_REALLOC event, its result gets the object
+ * id of the MM_TRACE_REALLOCATED alloc the same thread records next.
+ *
+ * gcc -O2 -pthread Trace_Replay.c MemoryManager.c glthread.c -o trace_replay
+ * ./trace_replay [-i sample_interval] [-s] [-d direct_mmap_threshold] trace_file
+ *
+ *  -s  registers every family but arena ones in slab mode
+ *
+ * Prints a CSV timeline of pages mapped, bytes in use and fragmentation
+ * every sample_interval events, then a summary on lines starting with #.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "Bench_Perf.h"
+#include "UserAPI_MemoryManager.h"
+
+/*Maps recorded object addresses to replayed ones, open addressing*/
+typedef struct replay_object_{
+
+    uint64_t ptr_id;    /*0 marks an empty slot*/
+    void *ptr;
+} replay_object_t;
+
+typedef struct replay_object_table_{
+
+    replay_object_t *slots;
+    uint64_t capacity;  /*power of 2*/
+    uint64_t count;
+} replay_object_table_t;
+
+static inline uint64_t
+replay_hash(uint64_t ptr_id){
+
+    ptr_id ^= ptr_id >> 33;
+    ptr_id *= 0xff51afd7ed558ccdULL;
+    ptr_id ^= ptr_id >> 33;
+    return ptr_id;
+}
+
+static void
+replay_object_insert(replay_object_table_t *table, uint64_t ptr_id, void *ptr);
+
+static void
+replay_object_table_grow(replay_object_table_t *table){
+
+    uint64_t i = 0;
+    replay_object_table_t new_table;
+
+    new_table.capacity = table->capacity ? table->capacity * 2 : 1024;
+    new_table.count = 0;
+    new_table.slots = calloc(new_table.capacity, sizeof(replay_object_t));
+    if(!new_table.slots){
+        fprintf(stderr, "Error : Out of memory for the object table\n");
+        exit(1);
+    }
+
+    for( ; i < table->capacity; i++){
+        if(table->slots[i].ptr_id)
+            replay_object_insert(&new_table, table->slots[i].ptr_id,
+                    table->slots[i].ptr);
+    }
+    free(table->slots);
+    *table = new_table;
+}
+
+static void
+replay_object_insert(replay_object_table_t *table, uint64_t ptr_id, void *ptr){
+
+    uint64_t i = 0;
+
+    if((table->count + 1) * 2 > table->capacity)
+        replay_object_table_grow(table);
+
+    i = replay_hash(ptr_id) & (table->capacity - 1);
+    while(table->slots[i].ptr_id && table->slots[i].ptr_id != ptr_id)
+        i = (i + 1) & (table->capacity - 1);
+
+    if(!table->slots[i].ptr_id)
+        table->count++;
+    table->slots[i].ptr_id = ptr_id;
+    table->slots[i].ptr = ptr;
+}
+
+/*Removes ptr_id, returns its replayed object or NULL if unknown*/
+static void *
+replay_object_remove(replay_object_table_t *table, uint64_t ptr_id){
+
+    uint64_t i = 0, j = 0, home = 0;
+    void *ptr = NULL;
+
+    if(!table->capacity)
+        return NULL;
+
+    i = replay_hash(ptr_id) & (table->capacity - 1);
+    while(table->slots[i].ptr_id != ptr_id){
+        if(!table->slots[i].ptr_id)
+            return NULL;
+        i = (i + 1) & (table->capacity - 1);
+    }
+    ptr = table->slots[i].ptr;
+    table->count--;
+
+    /*Shift later entries of the probe run back into the hole*/
+    j = i;
+    for( ; ; ){
+        table->slots[i].ptr_id = 0;
+        for( ; ; ){
+            j = (j + 1) & (table->capacity - 1);
+            if(!table->slots[j].ptr_id)
+                return ptr;
+            home = replay_hash(table->slots[j].ptr_id) & (table->capacity - 1);
+            /*Movable unless home lies cyclically in (i, j]*/
+            if(i <= j ? (home <= i || home > j) : (home <= i && home > j))
+                break;
+        }
+        table->slots[i] = table->slots[j];
+        i = j;
+    }
+}
+
+/*Replayed handles indexed by recorded family_id*/
+typedef struct replay_families_{
+
+    mm_family_handle_t *handles;
+    char (*names)[32];
+    uint32_t capacity;
+} replay_families_t;
+
+static void
+replay_register(replay_families_t *families, mm_trace_event_t *event,
+        int force_slab){
+
+    uint32_t id = event->family_id;
+    mm_family_attr_t attr;
+
+    if(id >= families->capacity){
+        uint32_t capacity = families->capacity ? families->capacity : 16;
+        while(capacity <= id)
+            capacity *= 2;
+        families->handles = realloc(families->handles,
+                capacity * sizeof(*families->handles));
+        families->names = realloc(families->names,
+                capacity * sizeof(*families->names));
+        memset(families->handles + families->capacity, 0,
+                (capacity - families->capacity) * sizeof(*families->handles));
+        families->capacity = capacity;
+    }
+
+    if(families->handles[id])
+        return;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.flags = event->flags;
+    /*Arena families keep their mode*/
+    if(force_slab && !(attr.flags & MM_FAMILY_ARENA))
+        attr.flags |= MM_FAMILY_SLAB;
+    attr.align = (uint32_t)event->ptr_id;
+    snprintf(families->names[id], sizeof(families->names[id]),
+            "trace_family_%u", id);
+    families->handles[id] = mm_instantiate_new_page_family_ex(
+            families->names[id], event->units, &attr);
+}
+
+static void
+replay_unregister(replay_families_t *families, mm_trace_event_t *event){
+
+    uint32_t id = event->family_id;
+
+    if(id >= families->capacity || !families->handles[id])
+        return;
+    mm_unregister_page_family(families->names[id]);
+    families->handles[id] = NULL;
+}
+
+/* Objects of the family stay in the object table, the recorded frees
+ * which would remove them never come*/
+static void
+replay_release_all(replay_families_t *families, mm_trace_event_t *event){
+
+    uint32_t id = event->family_id;
+
+    if(id >= families->capacity || !families->handles[id])
+        return;
+    mm_family_release_all(families->handles[id]);
+}
+
+static void
+replay_arena_reset(replay_families_t *families, mm_trace_event_t *event){
+
+    uint32_t id = event->family_id;
+
+    if(id >= families->capacity || !families->handles[id])
+        return;
+    mm_arena_reset(families->handles[id]);
+}
+
+/*Replayed xrealloc() results awaiting the id of the recorded result*/
+typedef struct replay_pending_{
+
+    uint32_t thread_id;
+    void *ptr;
+} replay_pending_t;
+
+typedef struct replay_pending_list_{
+
+    replay_pending_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+} replay_pending_list_t;
+
+static void
+replay_pending_add(replay_pending_list_t *pending, uint32_t thread_id,
+        void *ptr){
+
+    if(pending->count == pending->capacity){
+        pending->capacity = pending->capacity ? pending->capacity * 2 : 16;
+        pending->entries = realloc(pending->entries,
+                pending->capacity * sizeof(replay_pending_t));
+    }
+    pending->entries[pending->count].thread_id = thread_id;
+    pending->entries[pending->count].ptr = ptr;
+    pending->count++;
+}
+
+/*Few threads reallocate at once, a linear search is enough*/
+static void *
+replay_pending_take(replay_pending_list_t *pending, uint32_t thread_id){
+
+    uint32_t i = 0;
+    void *ptr = NULL;
+
+    for( ; i < pending->count; i++){
+        if(pending->entries[i].thread_id != thread_id)
+            continue;
+        ptr = pending->entries[i].ptr;
+        pending->entries[i] = pending->entries[--pending->count];
+        return ptr;
+    }
+    return NULL;
+}
+
+typedef struct replay_sample_{
+
+    uint64_t pages_mapped;
+    uint64_t bytes_in_use;
+    double fragmentation;
+} replay_sample_t;
+
+static void
+replay_sample(mm_stats_t *stats, replay_sample_t *sample){
+
+    uint32_t i = 0;
+    size_t page_size = getpagesize();
+
+    mm_get_stats(stats);
+    if(stats->family_count > stats->families_capacity){
+        stats->families_capacity = stats->family_count * 2;
+        stats->families = realloc(stats->families,
+                stats->families_capacity * sizeof(mm_family_stats_t));
+        mm_get_stats(stats);
+    }
+
+    sample->pages_mapped = stats->pages_mapped;
+    sample->bytes_in_use = 0;
+    for( ; i < stats->family_count && i < stats->families_capacity; i++)
+        sample->bytes_in_use += stats->families[i].bytes_in_use;
+
+    /*Share of the mapped memory not holding live objects*/
+    sample->fragmentation = sample->pages_mapped ?
+        1.0 - (double)sample->bytes_in_use /
+            ((double)sample->pages_mapped * page_size) : 0.0;
+}
+
+int
+main(int argc, char **argv){
+
+    int opt, force_slab = 0;
+    uint32_t align = 0;
+    uint64_t interval = 100000;
+    uint64_t events = 0, allocs = 0, frees = 0, reallocs = 0;
+    uint64_t unmatched = 0, failed = 0;
+    uint64_t peak_pages = 0;
+    double replay_ns = 0, start_ns;
+    FILE *fp = NULL;
+    void *ptr = NULL;
+    mm_trace_file_header_t header;
+    mm_trace_event_t event;
+    replay_families_t families;
+    replay_object_table_t objects;
+    replay_pending_list_t pending;
+    mm_stats_t stats;
+    replay_sample_t sample;
+
+    mm_init();
+
+    while((opt = getopt(argc, argv, "i:sd:")) != -1){
+        switch(opt){
+            case 'i':
+                interval = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                force_slab = 1;
+                break;
+            case 'd':
+                mm_set_direct_mmap_threshold(strtoul(optarg, NULL, 10));
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if(optind != argc - 1 || !interval){
+        fprintf(stderr, "usage : %s [-i sample_interval] [-s] "
+                "[-d direct_mmap_threshold] trace_file\n", argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if(!fp){
+        fprintf(stderr, "Error : Cannot open %s\n", argv[optind]);
+        return 1;
+    }
+    if(fread(&header, sizeof(header), 1, fp) != 1 ||
+            header.magic != MM_TRACE_MAGIC ||
+            header.event_size != sizeof(mm_trace_event_t)){
+        fprintf(stderr, "Error : %s is not a trace file\n", argv[optind]);
+        fclose(fp);
+        return 1;
+    }
+
+    memset(&families, 0, sizeof(families));
+    memset(&objects, 0, sizeof(objects));
+    memset(&pending, 0, sizeof(pending));
+    memset(&stats, 0, sizeof(stats));
+
+    printf("events,replay_ms,pages_mapped,bytes_in_use,fragmentation\n");
+
+    start_ns = bench_now_ns();
+    while(fread(&event, sizeof(event), 1, fp) == 1){
+
+        switch(event.type){
+            case MM_TRACE_REGISTER:
+                replay_register(&families, &event, force_slab);
+                break;
+            case MM_TRACE_UNREGISTER:
+                replay_unregister(&families, &event);
+                break;
+            case MM_TRACE_ALLOC:
+                if(event.flags & MM_TRACE_REALLOCATED){
+                    ptr = replay_pending_take(&pending, event.thread_id);
+                    if(ptr){
+                        replay_object_insert(&objects, event.ptr_id, ptr);
+                        break;
+                    }
+                    /*The reallocated object predates the recording*/
+                }
+                if(event.family_id >= families.capacity ||
+                        !families.handles[event.family_id]){
+                    failed++;
+                    break;
+                }
+                align = 1U << (event.flags >> MM_TRACE_ALIGN_SHIFT);
+                ptr = (event.flags & MM_TRACE_ZEROED) ?
+                    xcalloc_aligned(families.handles[event.family_id],
+                            event.units, align) :
+                    xmalloc_aligned(families.handles[event.family_id],
+                            event.units, align);
+                if(!ptr){
+                    failed++;
+                    break;
+                }
+                replay_object_insert(&objects, event.ptr_id, ptr);
+                allocs++;
+                break;
+            case MM_TRACE_FREE:
+                ptr = replay_object_remove(&objects, event.ptr_id);
+                if(!ptr){
+                    /*Allocated before the recording started*/
+                    unmatched++;
+                    break;
+                }
+                xfree(ptr);
+                frees++;
+                break;
+            case MM_TRACE_REALLOC:
+                ptr = replay_object_remove(&objects, event.ptr_id);
+                if(!ptr){
+                    unmatched++;
+                    break;
+                }
+                ptr = xrealloc(ptr, event.units);
+                if(!ptr){
+                    failed++;
+                    break;
+                }
+                replay_pending_add(&pending, event.thread_id, ptr);
+                reallocs++;
+                break;
+            case MM_TRACE_RELEASE_ALL:
+                replay_release_all(&families, &event);
+                break;
+            case MM_TRACE_ARENA_RESET:
+                replay_arena_reset(&families, &event);
+                break;
+        }
+
+        if(++events % interval == 0){
+            replay_ns += bench_now_ns() - start_ns;
+            replay_sample(&stats, &sample);
+            if(sample.pages_mapped > peak_pages)
+                peak_pages = sample.pages_mapped;
+            printf("%llu,%.1f,%llu,%llu,%.4f\n", (unsigned long long)events,
+                    replay_ns / 1e6,
+                    (unsigned long long)sample.pages_mapped,
+                    (unsigned long long)sample.bytes_in_use,
+                    sample.fragmentation);
+            start_ns = bench_now_ns();
+        }
+    }
+    replay_ns += bench_now_ns() - start_ns;
+    fclose(fp);
+
+    replay_sample(&stats, &sample);
+    if(sample.pages_mapped > peak_pages)
+        peak_pages = sample.pages_mapped;
+
+    printf("# events %llu, allocs %llu, frees %llu, reallocs %llu, "
+            "unmatched objects %llu, failed allocs %llu\n",
+            (unsigned long long)events, (unsigned long long)allocs,
+            (unsigned long long)frees, (unsigned long long)reallocs,
+            (unsigned long long)unmatched, (unsigned long long)failed);
+    printf("# throughput %.0f events/s, %.1f ns/event\n",
+            replay_ns ? events / (replay_ns / 1e9) : 0.0,
+            events ? replay_ns / events : 0.0);
+    printf("# peak pages sampled %llu, final pages %llu, final fragmentation %.4f\n",
+            (unsigned long long)peak_pages,
+            (unsigned long long)sample.pages_mapped, sample.fragmentation);
+    return 0;
+}
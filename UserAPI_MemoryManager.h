@@ -4,30 +4,398 @@
 
 
 #include <stdint.h>
+#include <stddef.h> /*size_t*/
+
+/*Opaque handle of a registered page family*/
+typedef struct vm_page_family_ *mm_family_handle_t;
 
 void *
 xcalloc(char *struct_name, int units);
+void *
+xcalloc_h(mm_family_handle_t family_handle, int units);
 void xfree(void *ptr);
 
+/*Non zeroing variants of xcalloc() and xcalloc_h()*/
+void *
+xmalloc(char *struct_name, int units);
+void *
+xmalloc_h(mm_family_handle_t family_handle, int units);
+
+#define XMALLOC(units, struct_name) \
+    (xmalloc(#struct_name, units))
+
+/* Allocates n zeroed single unit objects of the page family into
+ * out[], carving them from as few free runs as possible. Returns the
+ * no of objects allocated*/
+int
+xcalloc_bulk(mm_family_handle_t family_handle, int n, void **out);
+
+/* Frees n objects, which may belong to different page families. The
+ * ptrs array is sorted by address in place*/
+void
+xfree_bulk(void **ptrs, int n);
+
 #define XCALLOC(units, struct_name) \
     (xcalloc(#struct_name, units))
 
+/* Like xcalloc_h() and xmalloc_h(), with the object aligned to 'align'
+ * bytes, a power of 2 up to the system page size. Cache line aligned
+ * objects keep per thread data from sharing lines. xrealloc() keeps
+ * only the alignment of the page family*/
+void *
+xcalloc_aligned(mm_family_handle_t family_handle, int units, uint32_t align);
+void *
+xmalloc_aligned(mm_family_handle_t family_handle, int units, uint32_t align);
+
+/* Resizes ptr to new_units objects of its page family, in place when
+ * the neighbouring memory allows it. Returns the possibly moved object
+ * or NULL on failure, in which case ptr is left untouched. new_units
+ * of 0 frees ptr. Like realloc(), the grown part is not zeroed*/
+void *
+xrealloc(void *ptr, int new_units);
+
+/*A handle cached by a call site, see XCALLOC_T()*/
+typedef struct mm_family_handle_cache_{
+
+    mm_family_handle_t handle;
+    uint64_t registration;
+} mm_family_handle_cache_t;
+
+/* Returns the cached handle while its page family is still the one
+ * registered when it was cached, else resolves struct_name again and
+ * caches the result. Zero initialize the cache before the first call*/
+mm_family_handle_t
+mm_get_cached_page_family_handle(mm_family_handle_cache_t *handle_cache,
+        char *struct_name);
+
+/* Resolves the page family of struct_name once per call site and
+ * caches the handle in a static, later calls skip the name lookup
+ * until the family is unregistered*/
+#define XCALLOC_T(units, struct_name)                                   \
+    ({                                                                  \
+        static mm_family_handle_cache_t _mm_family_handle_cache;        \
+        (struct_name *)xcalloc_h(mm_get_cached_page_family_handle(      \
+                    &_mm_family_handle_cache, #struct_name), units);    \
+    })
+
 #define XFREE(ptr)  \
     (xfree(ptr))
 
-/*Initialization Functions*/
+/* Non zero if ptr lies in memory handed out by the memory manager.
+ * Safe to call on any address*/
+int
+mm_owns_pointer(void *ptr);
+
+/* Usable bytes of an object of the memory manager, at least what was
+ * requested. 0 for memory it does not own*/
+size_t
+xusable_size(void *ptr);
+
+/* Initialization Functions. mm_init() also installs fork handlers
+ * which keep the memory manager usable in the child*/
 void
 mm_init();
 
-/*Registration function*/
-void
+/*Registration function, returns NULL on failure*/
+mm_family_handle_t
 mm_instantiate_new_page_family(
         char *struct_name,
         uint32_t struct_size);
 
+mm_family_handle_t
+mm_get_page_family_handle(char *struct_name);
+
+/*Page family of an object of the memory manager, NULL for other memory*/
+mm_family_handle_t
+mm_get_page_family_handle_of(void *ptr);
+
+/* Releases every VM page of the page family and removes it from the
+ * registry. Handles and objects of the family become invalid, so no
+ * other thread may be using the family*/
+void
+mm_unregister_page_family(char *struct_name);
+
+/* Frees every object of the page family at once. Its VM pages are
+ * dropped whole, without visiting their blocks, into the page caches
+ * or back to the kernel, so teardown costs O(pages). The dtor of a
+ * ctor family runs on every object, live ones as they are. The family
+ * stays registered, but no other thread may be using its objects*/
+void
+mm_family_release_all(mm_family_handle_t handle);
+
+/* Frees every object of an MM_FAMILY_ARENA family at once by rewinding
+ * its VM pages, which are kept for the objects to come. No other
+ * thread may be using its objects*/
+void
+mm_arena_reset(mm_family_handle_t handle);
+
+#define MM_UNREG_STRUCT(struct_name)    \
+    (mm_unregister_page_family(#struct_name))
+
 #define MM_REG_STRUCT(struct_name)  \
     (mm_instantiate_new_page_family(#struct_name, sizeof(struct_name)))
 
+/* Single unit objects live header-less in slab pages, their state is
+ * kept in a per page bitmap. Multi unit requests still get a headered
+ * block. Ignored for structures too big to fill a page with at least
+ * a handful of objects*/
+#define MM_FAMILY_SLAB  (1 << 0)
+
+/* Objects are bumped off the top of the current VM page of the family
+ * and live until mm_arena_reset(), xfree() only counts them. Objects
+ * of at least the direct mmap threshold are still freed. Not to be
+ * combined with MM_FAMILY_SLAB*/
+#define MM_FAMILY_ARENA (1 << 1)
+
+/* Which free block a page family splits for a request. Packing the
+ * blocks into few pages lets the other pages empty and be released
+ * under long lived churn*/
+typedef enum{
+
+    MM_PLACEMENT_BEST_FIT,      /*smallest fitting block, the default*/
+    MM_PLACEMENT_FIRST_FIT,     /*lowest addressed fitting block*/
+    MM_PLACEMENT_FULLEST_PAGE,  /*fitting block of the most occupied page*/
+    MM_PLACEMENT_POLICIES
+} mm_placement_policy_t;
+
+typedef void (*mm_object_fn_t)(void *obj);
+
+/*Optional attributes of a page family, zero initialize unused fields*/
+typedef struct mm_family_attr_{
+
+    uint32_t flags;     /*MM_FAMILY_* bits*/
+    /* Alignment of every object of the family, a power of 2 up to the
+     * system page size. 0 keeps the default of 16 bytes*/
+    uint32_t align;
+    mm_placement_policy_t placement;
+    /* Object caching : ctor runs once on every object of a slab page as
+     * the page joins the family, dtor as the page leaves the family
+     * page cache. Objects are handed out, and must be freed, in their
+     * constructed state, xcalloc() does not zero them. Forces
+     * MM_FAMILY_SLAB, objects are then allocated one at a time. Neither
+     * hook may allocate from or free to its own family*/
+    mm_object_fn_t ctor;
+    mm_object_fn_t dtor;    /*optional, needs a ctor*/
+} mm_family_attr_t;
+
+mm_family_handle_t
+mm_instantiate_new_page_family_ex(
+        char *struct_name,
+        uint32_t struct_size,
+        mm_family_attr_t *attr);
+
+#define MM_REG_STRUCT_EX(struct_name, attr)  \
+    (mm_instantiate_new_page_family_ex(#struct_name, sizeof(struct_name), attr))
+
+/* Allocations of at least 'threshold' bytes are served from a
+ * dedicated mmap and unmapped again on xfree*/
+void
+mm_set_direct_mmap_threshold(uint32_t threshold);
+
+/* Whole system pages inside free blocks of multi page spans are given
+ * back to the kernel with MADV_FREE, or MADV_DONTNEED, once they add
+ * up to 'threshold' bytes. The blocks stay mapped, 0 disables it*/
+void
+mm_set_purge_threshold(uint32_t threshold);
+
+typedef enum{
+
+    MM_HUGE_PAGE_NONE,
+    /*2 MB aligned regions advised with MADV_HUGEPAGE*/
+    MM_HUGE_PAGE_TRANSPARENT,
+    /*MAP_HUGETLB regions, falling back to transparent ones*/
+    MM_HUGE_PAGE_EXPLICIT
+} mm_huge_page_mode_t;
+
+/* Selects where single VM pages come from. Takes effect for pages
+ * requested from the kernel afterwards*/
+void
+mm_set_huge_page_mode(mm_huge_page_mode_t mode);
+
+/* Max no of empty VM pages retained per page family and globally
+ * before they are unmapped*/
+void
+mm_set_page_cache_limits(uint32_t family_max_pages,
+        uint32_t global_max_pages);
+
+/*Return the blocks cached by the calling thread to their page families*/
+void
+mm_tcache_flush();
+
+/* NUMA. Page families keep their free blocks, partial slab pages and
+ * cached pages apart per node. New VM pages are bound to the node of
+ * the thread mapping them, and allocations are served from blocks of
+ * the caller's node. The topology is read from sysfs by mm_init(),
+ * machines with more nodes than this fold the extra ones*/
+#define MM_MAX_NUMA_NODES   4
+
+uint32_t
+mm_numa_node_count();
+
+/* Pretends the machine has node_count nodes, CPUs being spread over
+ * them round robin, so that the NUMA paths can be exercised on a
+ * single node machine. Pages are not bound then. 0 goes back to the
+ * real topology*/
+void
+mm_numa_set_fake_topology(uint32_t node_count);
+
+/* Makes the calling thread allocate as if it ran on 'node', -1 goes
+ * back to the node of the CPU it runs on*/
+void
+mm_numa_set_thread_node(int node);
+
+typedef struct mm_node_stats_{
+
+    uint64_t pages_mapped;      /*system pages bound to the node, caches included*/
+    uint64_t local_allocs;      /*blocks taken from the free lists of the caller's node*/
+    uint64_t remote_allocs;     /*blocks taken from another node, the caller's being out of memory*/
+} mm_node_stats_t;
+
+typedef struct mm_family_stats_{
+
+    char struct_name[32];
+    uint32_t struct_size;
+    uint64_t blocks_in_use;     /*thread cached blocks included*/
+    uint64_t blocks_free;
+    uint64_t bytes_in_use;      /*payload bytes of the blocks in use*/
+    uint64_t pages_mapped;      /*system pages, page cache included*/
+    uint64_t pages_cached;      /*VM pages in the family page cache*/
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t page_maps;         /*system pages mapped from the kernel*/
+    uint64_t page_unmaps;       /*system pages given back to the kernel*/
+    uint64_t page_cache_hits;
+    uint64_t bytes_purged;      /*of free blocks, given back with madvise*/
+    uint64_t purges;            /*madvise calls*/
+} mm_family_stats_t;
+
+typedef struct mm_stats_{
+
+    /*Set by the caller : room for families_capacity entries, or NULL*/
+    mm_family_stats_t *families;
+    uint32_t families_capacity;
+    /*No of registered families, entries filled are capped by capacity*/
+    uint32_t family_count;
+    uint64_t pages_mapped;      /*all families plus the global page cache*/
+    uint64_t global_cache_pages;
+    uint64_t global_cache_hits;
+    uint64_t huge_regions_mapped;
+    uint32_t numa_node_count;
+    mm_node_stats_t nodes[MM_MAX_NUMA_NODES];   /*numa_node_count filled*/
+} mm_stats_t;
+
+/* Snapshot of the counters the memory manager maintains on the fly,
+ * no page or block is walked. Allocations and frees served by thread
+ * caches are accounted when the cache next exchanges blocks with its
+ * page family. Returns the no of family entries filled*/
+uint32_t
+mm_get_stats(mm_stats_t *stats);
+
+/* Serializers of a snapshot into buf. Like snprintf(), they return the
+ * length the full output needs, buf holds a truncated output if it is
+ * too short*/
+int
+mm_stats_to_json(mm_stats_t *stats, char *buf, size_t buf_size);
+int
+mm_stats_to_prometheus(mm_stats_t *stats, char *buf, size_t buf_size);
+
+/* Latency histograms, recorded per page family while tracking is on.
+ * Buckets are log spaced with MM_LATENCY_SUB_BUCKETS linear steps per
+ * power of two, which bounds the relative error to 1/8*/
+typedef enum{
+
+    MM_LATENCY_ALLOC,           /*xcalloc() and friends*/
+    MM_LATENCY_FREE,            /*xfree()*/
+    MM_LATENCY_PAGE_ACQUIRE,    /*VM page taken from a cache or the kernel*/
+    MM_LATENCY_PAGE_RELEASE,    /*VM page given up by the family*/
+    MM_LATENCY_OPS
+} mm_latency_op_t;
+
+#define MM_LATENCY_SUB_BUCKET_BITS  3
+#define MM_LATENCY_SUB_BUCKETS      (1 << MM_LATENCY_SUB_BUCKET_BITS)
+#define MM_LATENCY_BUCKETS          \
+    (MM_LATENCY_SUB_BUCKETS * (64 - MM_LATENCY_SUB_BUCKET_BITS + 1))
+
+typedef struct mm_latency_histogram_{
+
+    uint64_t count;
+    uint64_t max_ns;
+    uint64_t buckets[MM_LATENCY_BUCKETS];
+} mm_latency_histogram_t;
+
+/* Turns latency tracking on or off for all page families. Histograms
+ * are allocated the first time a family records a sample*/
+void
+mm_set_latency_tracking(int enable);
+
+/*Copies a histogram of the family, returns -1 if it has none yet*/
+int
+mm_get_latency_histogram(mm_family_handle_t family_handle,
+        mm_latency_op_t op, mm_latency_histogram_t *histogram);
+
+/*Clears the histograms of the family, or of all families for NULL*/
+void
+mm_reset_latency_histograms(mm_family_handle_t family_handle);
+
+/*Smallest latency of the bucket, in ns*/
+uint64_t
+mm_latency_bucket_lower_ns(uint32_t bucket_index);
+
+/* Latency under which 'percentile' percent of the samples fall, up to
+ * the bucket resolution*/
+uint64_t
+mm_latency_percentile(mm_latency_histogram_t *histogram, double percentile);
+
+/* Allocation tracing. While on, every registration, allocation and
+ * free appends an event to a lock-free ring which a background thread
+ * writes to a file, see Trace_Replay.c. Events which find the ring
+ * full are dropped and counted*/
+typedef enum{
+
+    MM_TRACE_REGISTER,
+    MM_TRACE_UNREGISTER,
+    MM_TRACE_ALLOC,
+    MM_TRACE_FREE,
+    MM_TRACE_REALLOC,       /*recorded before xrealloc() with the old object*/
+    MM_TRACE_RELEASE_ALL,
+    MM_TRACE_ARENA_RESET
+} mm_trace_event_type_t;
+
+#define MM_TRACE_ZEROED     (1 << 0)    /*alloc flag : xcalloc(), not xmalloc()*/
+#define MM_TRACE_REALLOCATED (1 << 1)   /*alloc flag : result of an xrealloc()*/
+/*alloc flags : log2 of the alignment asked of xcalloc_aligned() and friends*/
+#define MM_TRACE_ALIGN_SHIFT 8
+
+typedef struct mm_trace_event_{
+
+    uint64_t timestamp_ns;  /*CLOCK_MONOTONIC*/
+    uint64_t ptr_id;        /*address of the object, alignment for registrations*/
+    uint32_t thread_id;
+    uint32_t family_id;
+    uint32_t units;         /*struct_size for MM_TRACE_REGISTER*/
+    uint16_t type;          /*mm_trace_event_type_t*/
+    uint16_t flags;         /*MM_TRACE_ZEROED, MM_FAMILY_* for registrations*/
+} mm_trace_event_t;
+
+/*A trace file is this header followed by mm_trace_event_t records*/
+#define MM_TRACE_MAGIC      0x3145434152544d4dULL  /*"MMTRACE1"*/
+
+typedef struct mm_trace_file_header_{
+
+    uint64_t magic;
+    uint32_t event_size;
+    uint32_t reserved;
+} mm_trace_file_header_t;
+
+/* Starts recording to path, registered families are recorded first.
+ * Returns 0, or -1 if tracing is on already or path cannot be opened*/
+int
+mm_trace_start(const char *path);
+
+/*Stops recording and closes the file, returns the no of dropped events*/
+uint64_t
+mm_trace_stop();
+
 void mm_print_memory_usage(char *struct_name);
 void mm_print_registered_page_families();
 void mm_print_block_usage();